@@ -0,0 +1,298 @@
+/* Runs many "ROM, input movie, frame count" jobs on all cores, one console
+ * per job, and streams a JSON line per finished job to stdout: hashes of
+ * the frames (see frame_hash) and the internal RAM at the end.
+ *
+ * A manifest line is "rom.nes movie.fm2 frames", with "-" for no movie.
+ * Blank lines and lines starting with # are skipped.
+ *
+ * --scaling runs the manifest once more on 1, 2, 4... threads up to the
+ * core count first and reports the speed of each against one thread.
+ *
+ * USAGE: nesemu-batch [--jit] [--threads N] [--scaling] [--frame-hashes] manifest */
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <array>
+#include <mutex>
+#include <thread>
+#include <iterator>
+#include <climits>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+
+#include "nesemu.h"
+#include "movie.h"
+#include "work_pool.h"
+#include "common.h"
+
+std::ostream& logger = std::clog;
+
+struct Job {
+	std::string rom;
+	std::string movie_path;
+	Movie movie;
+	unsigned frames;
+};
+
+struct Result {
+	uint64_t last_frame = 0;
+	uint64_t all_frames = 0;
+	std::vector<uint64_t> frame_hashes;
+	std::array<uint8_t, 0x800> ram;
+	uint64_t cpu_cycles;
+	double seconds;
+};
+
+static std::vector<Job> read_manifest(const std::string& path)
+{
+	std::ifstream file{ path };
+	if (!file.is_open()) {
+		GLOBAL_ERROR("cannot open the manifest");
+	}
+
+	std::vector<Job> jobs;
+	std::string line;
+	while (std::getline(file, line)) {
+		std::istringstream fields{ line };
+		Job job;
+		if (!(fields >> job.rom) || job.rom[0] == '#') {
+			continue;
+		}
+		if (!(fields >> job.movie_path >> job.frames)) {
+			GLOBAL_ERROR("manifest lines are: rom.nes movie.fm2|- frames");
+		}
+
+		// fail before any job runs rather than halfway through the batch
+		std::ifstream rom{ job.rom, std::ios::binary };
+		if (!rom.is_open()) {
+			GLOBAL_ERROR("cannot open a ROM of the manifest");
+		}
+		std::vector<uint8_t> image{ std::istreambuf_iterator<char>{ rom }, std::istreambuf_iterator<char>{} };
+		if (!Cartridge::supports_ines(image.data(), image.size())) {
+			GLOBAL_ERROR("a ROM of the manifest is no iNES image or needs an unimplemented mapper");
+		}
+		if (job.movie_path != "-") {
+			std::ifstream movie{ job.movie_path };
+			if (!movie.is_open()) {
+				GLOBAL_ERROR("cannot open a movie of the manifest");
+			}
+			job.movie = Movie::from_fm2(movie);
+		}
+		jobs.push_back(std::move(job));
+	}
+	return jobs;
+}
+
+static Result run_job(const Job& job, bool use_jit, bool frame_hashes)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	Result result;
+	// far too big for a worker's stack
+	std::unique_ptr<Console> console{ new Console };
+	console->load(job.rom);
+	console->cpu.set_jit(use_jit);
+
+	Movie movie = job.movie;
+	Hashing_sink sink{ frame_hashes };
+	console->video.set_sink(&sink);
+	console->controllers.set_input(&movie);
+
+	for (unsigned i = 0; i < job.frames; ++i) {
+		console->scheduler.run_frame();
+		movie.next_frame();
+	}
+
+	result.last_frame = sink.last;
+	result.all_frames = sink.combined;
+	result.frame_hashes = std::move(sink.hashes);
+	for (uint16_t addr = 0; addr < result.ram.size(); ++addr) {
+		result.ram[addr] = console->memory.read(addr);
+	}
+	result.cpu_cycles = console->cpu.cycles();
+
+	std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+	result.seconds = seconds.count();
+	return result;
+}
+
+static std::string json_string(const std::string& text)
+{
+	std::ostringstream out;
+	out << '"';
+	for (char c : text) {
+		if (c == '"' || c == '\\') {
+			out << '\\' << c;
+		} else if ((unsigned char)c < 0x20) {
+			out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c;
+		} else {
+			out << c;
+		}
+	}
+	out << '"';
+	return out.str();
+}
+
+static std::string hex64(uint64_t value)
+{
+	std::ostringstream out;
+	out << '"' << std::hex << std::setw(16) << std::setfill('0') << value << '"';
+	return out.str();
+}
+
+static std::string json_line(size_t index, const Job& job, const Result& result)
+{
+	std::ostringstream out;
+	out << "{\"job\":" << index
+		<< ",\"rom\":" << json_string(job.rom)
+		<< ",\"movie\":" << (job.movie_path == "-" ? "null" : json_string(job.movie_path))
+		<< ",\"frames\":" << job.frames
+		<< ",\"cpu_cycles\":" << result.cpu_cycles
+		<< ",\"seconds\":" << result.seconds
+		<< ",\"last_frame\":" << hex64(result.last_frame)
+		<< ",\"all_frames\":" << hex64(result.all_frames);
+	if (!result.frame_hashes.empty()) {
+		out << ",\"frame_hashes\":[";
+		for (size_t i = 0; i < result.frame_hashes.size(); ++i) {
+			out << (i ? "," : "") << hex64(result.frame_hashes[i]);
+		}
+		out << ']';
+	}
+	out << ",\"ram\":\"" << std::hex << std::setfill('0');
+	for (auto byte : result.ram) {
+		out << std::setw(2) << (unsigned)byte;
+	}
+	out << "\"}\n";
+	return out.str();
+}
+
+struct Run_stats {
+	double seconds;
+	// summed over the jobs, so busy / (seconds * threads) is the pool's use
+	double busy;
+	uint64_t frames;
+};
+
+/* Runs every job on the given number of threads. Results are streamed out
+ * as jobs finish if out is set, and kept in results either way. */
+static Run_stats run_batch(const std::vector<Job>& jobs, unsigned threads, bool use_jit,
+	bool frame_hashes, std::vector<Result>& results, std::ostream* out)
+{
+	Work_pool pool{ threads };
+	std::mutex out_lock;
+
+	results.assign(jobs.size(), Result{});
+	auto start = std::chrono::steady_clock::now();
+	pool.run(jobs.size(), [&](size_t i) {
+		results[i] = run_job(jobs[i], use_jit, frame_hashes);
+		if (out) {
+			auto line = json_line(i, jobs[i], results[i]);
+			std::lock_guard<std::mutex> guard{ out_lock };
+			*out << line << std::flush;
+		}
+	});
+	std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+
+	Run_stats stats{ seconds.count(), 0, 0 };
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		stats.busy += results[i].seconds;
+		stats.frames += jobs[i].frames;
+	}
+
+	unsigned stolen = 0;
+	for (auto& worker : pool.stats()) {
+		stolen += worker.stolen;
+	}
+	logger << threads << " threads: " << stats.frames << " frames in " << stats.seconds << " s, "
+		<< stats.frames / stats.seconds << " fps (" << stats.frames / stats.seconds / threads
+		<< " per thread), threads " << 100 * stats.busy / (stats.seconds * threads) << "% busy, "
+		<< stolen << " jobs stolen\n";
+	return stats;
+}
+
+static bool same_results(const std::vector<Result>& a, const std::vector<Result>& b)
+{
+	for (size_t i = 0; i < a.size(); ++i) {
+		if (a[i].all_frames != b[i].all_frames || a[i].ram != b[i].ram) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// --threads N, false (for the usage message) unless N is a number
+static bool parse_threads(const char* text, unsigned& threads)
+{
+	char* end;
+	errno = 0;
+	unsigned long count = std::strtoul(text, &end, 10);
+	if (!isdigit((unsigned char)*text) || *end || errno || count > UINT_MAX) {
+		return false;
+	}
+	threads = std::max(count, 1ul);
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	bool use_jit = false;
+	bool scaling = false;
+	bool frame_hashes = false;
+	unsigned cores = std::max(std::thread::hardware_concurrency(), 1u);
+	unsigned threads = cores;
+
+	for (int i = 1; i < argc - 1; ++i) {
+		std::string option{ argv[i] };
+		if (option == "--jit") {
+			use_jit = true;
+		} else if (option == "--scaling") {
+			scaling = true;
+		} else if (option == "--frame-hashes") {
+			frame_hashes = true;
+		} else if (option == "--threads" && i + 1 < argc - 1 && parse_threads(argv[i + 1], threads)) {
+			++i;
+		} else {
+			argc = 0;
+		}
+	}
+	if (argc < 2) {
+		logger << "usage: nesemu-batch [--jit] [--threads N] [--scaling] [--frame-hashes] manifest\n";
+		return EXIT_FAILURE;
+	}
+
+	auto jobs = read_manifest(argv[argc - 1]);
+	std::vector<Result> results;
+
+	if (scaling) {
+		std::vector<unsigned> counts;
+		for (unsigned n = 2; n < cores; n *= 2) {
+			counts.push_back(n);
+		}
+		if (cores > 1) {
+			counts.push_back(cores);
+		}
+
+		std::vector<Result> single;
+		auto base = run_batch(jobs, 1, use_jit, frame_hashes, single, nullptr);
+		for (auto n : counts) {
+			auto stats = run_batch(jobs, n, use_jit, frame_hashes, results, nullptr);
+			double speedup = base.seconds / stats.seconds;
+			logger << n << " threads: " << speedup << "x one thread, "
+				<< 100 * speedup / n << "% scaling efficiency\n";
+			if (!same_results(single, results)) {
+				logger << "results on " << n << " threads differ from one thread\n";
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	run_batch(jobs, threads, use_jit, frame_hashes, results, &std::cout);
+
+	return EXIT_SUCCESS;
+}
@@ -1,7 +1,7 @@
 #include "cart.h"
 #include "mappers/mapper0.h"
 
-Cartridge* cart = nullptr;
+#include <algorithm>
 
 static void choose_mapper(Mapper& mapper, uint8_t number)
 {
@@ -14,7 +14,28 @@ static void choose_mapper(Mapper& mapper, uint8_t number)
 	}
 }
 
-Cartridge* Cartridge::from_ines(std::ifstream& file)
+bool Cartridge::supports_mapper(uint8_t number)
+{
+	return number == 0;
+}
+
+bool Cartridge::supports_ines(const uint8_t* image, size_t size)
+{
+	if (size < header_size || !std::equal(image, image + 4, magic_const)) {
+		return false;
+	}
+	size_t rom_pages = image[4];
+	size_t vrom_pages = image[5];
+	uint8_t flag6 = image[6];
+	uint8_t flag7 = image[7];
+	if (rom_pages == 0 || vrom_pages == 0 || !supports_mapper((flag7 & 0xF0) | (flag6 >> 4))) {
+		return false;
+	}
+	size_t trainer = flag6 & BIT(2) ? trainer_size : 0;
+	return size >= header_size + trainer + rom_pages * rom_page_size + vrom_pages * vrom_page_size;
+}
+
+Cartridge* Cartridge::from_ines(std::istream& file)
 {
 	file.exceptions(std::ios::failbit | std::ios::badbit);
 
@@ -32,17 +53,18 @@ Cartridge* Cartridge::from_ines(std::ifstream& file)
 	uint8_t flag7 = file.get();
 
 	cart->mirroring = flag6 & BIT(0) ? Mirroring::vertical : Mirroring::horizontal;
-	choose_mapper(cart->mapper, (flag7 & 0xF0) | (flag6 >> 4));
+	cart->mapper_number = (flag7 & 0xF0) | (flag6 >> 4);
+	choose_mapper(cart->mapper, cart->mapper_number);
 	cart->has_battery = flag6 & BIT(1);
 
 	bool has_trainer = flag6 & BIT(2);
 
 	// skip rest of header
-	file.seekg(header_size, std::ifstream::beg);
+	file.seekg(header_size, std::ios::beg);
 
 	// skip trainer
 	if (has_trainer) {
-		file.seekg(trainer_size, std::ifstream::cur);
+		file.seekg(trainer_size, std::ios::cur);
 	}
 
 	// read prg_rom
@@ -60,12 +82,17 @@ Cartridge* Cartridge::from_ines(std::ifstream& file)
 	return cart;
 }
 
-uint8_t Cartridge::read(Extended_addr addr)
+uint8_t Cartridge::read(uint16_t addr)
+{
+	return mapper.read(*this, addr);
+}
+
+void Cartridge::write(uint16_t addr, uint8_t value)
 {
-	return mapper.read(addr);
+	mapper.write(*this, addr, value);
 }
 
-void Cartridge::write(Extended_addr addr, uint8_t value)
+void Cartridge::map(Memory& memory)
 {
-	mapper.write(addr, value);
-}
\ No newline at end of file
+	mapper.map(*this, memory);
+}
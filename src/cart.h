@@ -4,7 +4,7 @@
 #include "common.h"
 
 #include <vector>
-#include <fstream>
+#include <istream>
 #include <cstdint>
 
 const size_t header_size = 16;
@@ -19,30 +19,50 @@ enum class Mirroring {
 	vertical = 1
 };
 
+class Memory;
+class Ppu;
+class Cartridge;
+
 struct Mapper {
-	using Read_func = uint8_t (*)(Extended_addr addr);
-	using Write_func = void (*)(Extended_addr addr, uint8_t value);
+	using Read_func = uint8_t (*)(Cartridge& cart, uint16_t addr);
+	using Write_func = void (*)(Cartridge& cart, uint16_t addr, uint8_t value);
+	using Map_func = void (*)(Cartridge& cart, Memory& memory);
 
 	Read_func read;
 	Write_func write;
+	// (re)installs the PRG pages in the CPU page table,
+	// called on load and whenever the mapper switches banks
+	Map_func map;
 };
 
 class Cartridge {
 public:
 	bool has_battery;
+	uint8_t mapper_number;
 	Mirroring mirroring;
 
 	std::vector<uint8_t> rom;
 	std::vector<uint8_t> vrom;
 
-	static Cartridge* from_ines(std::ifstream& file);
+	// bank registers, their meaning is up to the mapper
+	size_t banks_count = 0;
+	int banks[2] = {};
+	// told about CHR changes the mapper makes
+	Ppu* ppu = nullptr;
+
+	static Cartridge* from_ines(std::istream& file);
+	// whether from_ines can load ROMs of this mapper
+	static bool supports_mapper(uint8_t number);
+	// whether the size bytes at image are an iNES file the console runs: a
+	// supported mapper, PRG ROM, CHR ROM (no CHR RAM yet) and every page the
+	// header counts, checked up front as from_ines ends the process
+	static bool supports_ines(const uint8_t* image, size_t size);
 
-	uint8_t read(Extended_addr addr);
-	void write(Extended_addr addr, uint8_t value);
+	uint8_t read(uint16_t addr);
+	void write(uint16_t addr, uint8_t value);
+	void map(Memory& memory);
 private:
 	Mapper mapper;
 };
 
-extern Cartridge* cart;
-
 #endif
@@ -12,6 +12,14 @@
 
 #define BIT(N) (1 << (N))
 
+/* Time base shared by all components: ticks of the NTSC master clock
+ * (21.477272 MHz). A CPU cycle takes 12 ticks, a PPU dot 4. */
+using Master_time = uint64_t;
+
+const Master_time master_clock_rate = 21477272;
+const Master_time cpu_cycle_ticks = 12;
+const Master_time ppu_dot_ticks = 4;
+
 inline void global_error [[noreturn]] (const char* msg, const char* file, unsigned line, const char* func)
 {
   fprintf(stderr, "error in [%s:%d:%d] -- %d\n", msg);
@@ -21,11 +29,6 @@ inline void global_error [[noreturn]] (const char* msg, const char* file, unsign
 #define GLOBAL_ERROR(MSG) \
   global_error((MSG), __FILE__, __LINE__, __func__)
 
-// negative numbers point to registers
-// non-negative to normal memory addresses
-using Extended_addr = int;
-const Extended_addr a_register_ext_addr = -1;
-
 #if LOGGING_ENABLED
   #define LOG(MSG)          fprintf(stderr, "%s:%d:%s(): " MSG "\n", __FILE__, __LINE__, __func__)
   #define LOG_FMT(MSG, ...) fprintf(stderr, "%s:%d:%s(): " MSG "\n", __FILE__, __LINE__, __func__, __VA_ARGS__)
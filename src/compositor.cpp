@@ -0,0 +1,137 @@
+#include "compositor.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define COMPOSITOR_SIMD 1
+#endif
+
+bool compose_line_scalar(const Line_layers& layers, uint8_t* out)
+{
+	bool hit = false;
+
+	for (unsigned x = 0; x < line_width; ++x) {
+		uint8_t background = 0;
+		if (layers.show_background && (x >= 8 || layers.show_left_background)) {
+			background = layers.background[x];
+		}
+		uint8_t sprite = 0;
+		if (layers.show_sprites && (x >= 8 || layers.show_left_sprites)) {
+			sprite = layers.sprites[x];
+		}
+
+		uint8_t color = sprite & sprite_color_mask;
+		if (sprite & sprite_zero && background && x != 255) {
+			hit = true;
+		}
+		out[x] = color && (!background || !(sprite & sprite_behind)) ? color : background;
+	}
+	return hit;
+}
+
+#if COMPOSITOR_SIMD
+
+/* Both vector versions turn the show/clip flags into byte masks per chunk:
+ * all ones, or all ones but the first 8 bytes of the first chunk. Sprite 0
+ * never hits at x = 255, the last bit of the last chunk's hit mask. */
+
+bool compose_line_sse2(const Line_layers& layers, uint8_t* out)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i color_mask = _mm_set1_epi8(sprite_color_mask);
+	const __m128i behind = _mm_set1_epi8(sprite_behind);
+	const __m128i sprite0 = _mm_set1_epi8(sprite_zero);
+	const __m128i left = _mm_set_epi64x(-1, 0);
+	const __m128i all = _mm_set1_epi8(-1);
+
+	__m128i show_bg = layers.show_background ? all : zero;
+	__m128i show_spr = layers.show_sprites ? all : zero;
+	__m128i show_bg_left = layers.show_left_background ? show_bg : _mm_and_si128(show_bg, left);
+	__m128i show_spr_left = layers.show_left_sprites ? show_spr : _mm_and_si128(show_spr, left);
+
+	unsigned hits = 0;
+	for (unsigned x = 0; x < line_width; x += 16) {
+		auto bg_in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(layers.background + x));
+		auto spr_in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(layers.sprites + x));
+		auto bg = _mm_and_si128(bg_in, x ? show_bg : show_bg_left);
+		auto spr = _mm_and_si128(spr_in, x ? show_spr : show_spr_left);
+
+		auto color = _mm_and_si128(spr, color_mask);
+		auto bg_clear = _mm_cmpeq_epi8(bg, zero);
+		auto in_front = _mm_cmpeq_epi8(_mm_and_si128(spr, behind), zero);
+		auto transparent = _mm_cmpeq_epi8(color, zero);
+		auto use_sprite = _mm_andnot_si128(transparent, _mm_or_si128(bg_clear, in_front));
+
+		auto result = _mm_or_si128(_mm_and_si128(use_sprite, color), _mm_andnot_si128(use_sprite, bg));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), result);
+
+		auto zero_hit = _mm_cmpeq_epi8(_mm_and_si128(spr, sprite0), sprite0);
+		hits |= _mm_movemask_epi8(_mm_andnot_si128(bg_clear, zero_hit))
+			& (x + 16 == line_width ? 0x7FFF : 0xFFFF);
+	}
+	return hits != 0;
+}
+
+__attribute__((target("avx2")))
+bool compose_line_avx2(const Line_layers& layers, uint8_t* out)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i color_mask = _mm256_set1_epi8(sprite_color_mask);
+	const __m256i behind = _mm256_set1_epi8(sprite_behind);
+	const __m256i sprite0 = _mm256_set1_epi8(sprite_zero);
+	const __m256i left = _mm256_set_epi64x(-1, -1, -1, 0);
+	const __m256i all = _mm256_set1_epi8(-1);
+
+	__m256i show_bg = layers.show_background ? all : zero;
+	__m256i show_spr = layers.show_sprites ? all : zero;
+	__m256i show_bg_left = layers.show_left_background ? show_bg : _mm256_and_si256(show_bg, left);
+	__m256i show_spr_left = layers.show_left_sprites ? show_spr : _mm256_and_si256(show_spr, left);
+
+	uint32_t hits = 0;
+	for (unsigned x = 0; x < line_width; x += 32) {
+		auto bg_in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(layers.background + x));
+		auto spr_in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(layers.sprites + x));
+		auto bg = _mm256_and_si256(bg_in, x ? show_bg : show_bg_left);
+		auto spr = _mm256_and_si256(spr_in, x ? show_spr : show_spr_left);
+
+		auto color = _mm256_and_si256(spr, color_mask);
+		auto bg_clear = _mm256_cmpeq_epi8(bg, zero);
+		auto in_front = _mm256_cmpeq_epi8(_mm256_and_si256(spr, behind), zero);
+		auto transparent = _mm256_cmpeq_epi8(color, zero);
+		auto use_sprite = _mm256_andnot_si256(transparent, _mm256_or_si256(bg_clear, in_front));
+
+		auto result = _mm256_blendv_epi8(bg, color, use_sprite);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), result);
+
+		auto zero_hit = _mm256_cmpeq_epi8(_mm256_and_si256(spr, sprite0), sprite0);
+		hits |= (uint32_t)_mm256_movemask_epi8(_mm256_andnot_si256(bg_clear, zero_hit))
+			& (x + 32 == line_width ? 0x7FFFFFFFu : 0xFFFFFFFFu);
+	}
+	return hits != 0;
+}
+
+static Compose_line pick_compose_line()
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return compose_line_avx2;
+	}
+	return compose_line_sse2;
+}
+
+const Compose_line compose_line = pick_compose_line();
+
+#else
+
+bool compose_line_sse2(const Line_layers& layers, uint8_t* out)
+{
+	return compose_line_scalar(layers, out);
+}
+
+bool compose_line_avx2(const Line_layers& layers, uint8_t* out)
+{
+	return compose_line_scalar(layers, out);
+}
+
+const Compose_line compose_line = compose_line_scalar;
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef NESEMU_COMPOSITOR_H
+#define NESEMU_COMPOSITOR_H
+
+#include <cstdint>
+
+/* Combines a scanline's background and sprite pixels into the 256 palette
+ * indices that are drawn, the way the PPU's priority multiplexer does per
+ * dot, with SSE2/AVX2 versions picked at run time on x86-64. */
+
+const unsigned line_width = 256;
+
+// sprite line pixel: palette index (16-31, or 0 where no sprite is opaque)
+// and the flags of the front-most opaque sprite
+const uint8_t sprite_color_mask = 0x1F;
+const uint8_t sprite_behind = 0x20;
+// some opaque pixel here belongs to sprite 0, even if another sprite wins
+const uint8_t sprite_zero = 0x40;
+
+struct Line_layers {
+	// background palette indices (0 where transparent)
+	const uint8_t* background;
+	// sprite line pixels, see sprite_color_mask
+	const uint8_t* sprites;
+
+	bool show_background;
+	bool show_left_background;
+	bool show_sprites;
+	bool show_left_sprites;
+};
+
+// writes line_width palette indices to out, returns whether sprite 0 hit
+using Compose_line = bool (*)(const Line_layers& layers, uint8_t* out);
+
+bool compose_line_scalar(const Line_layers& layers, uint8_t* out);
+bool compose_line_sse2(const Line_layers& layers, uint8_t* out);
+bool compose_line_avx2(const Line_layers& layers, uint8_t* out);
+
+// the best version this machine supports
+extern const Compose_line compose_line;
+
+#endif
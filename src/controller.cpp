@@ -1,12 +1,14 @@
 #include "controller.h"
-#include "screen.h"
 
-Controllers controllers;
+static uint8_t joypad_state(Input_source* input, int controller_number)
+{
+	return input ? input->joypad_state(controller_number) : 0;
+}
 
 uint8_t Controllers::read_state(int controller_number)
 {
 	if (strobe) {
-		return 0x40 | (screen.get_joypad_state(controller_number) & 1);
+		return 0x40 | (joypad_state(input, controller_number) & 1);
 	}
 
 	auto& state = joypads.at(controller_number);
@@ -18,9 +20,14 @@ uint8_t Controllers::read_state(int controller_number)
 void Controllers::write_strobe(bool value)
 {
 	if (strobe && !value) {
-		joypads[0] = screen.get_joypad_state(0);
-		joypads[1] = screen.get_joypad_state(1);
+		joypads[0] = joypad_state(input, 0);
+		joypads[1] = joypad_state(input, 1);
 	}
 
 	strobe = value;
 }
+
+void Controllers::set_input(Input_source* input)
+{
+	this->input = input;
+}
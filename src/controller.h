@@ -4,15 +4,25 @@
 #include <array>
 #include "common.h"
 
+/* Where the buttons come from, e.g. the keyboard. Without one no button is
+ * ever pressed. */
+class Input_source {
+public:
+	virtual ~Input_source() = default;
+
+	// buttons held on a controller, A in bit 0 to right in bit 7
+	virtual uint8_t joypad_state(int controller_number) = 0;
+};
+
 class Controllers {
 public:
 	uint8_t read_state(int controller_number);
 	void write_strobe(bool value);
+	void set_input(Input_source* input);
 private:
-	bool strobe;
-	std::array<uint8_t, 2> joypads;
+	Input_source* input = nullptr;
+	bool strobe = false;
+	std::array<uint8_t, 2> joypads{};
 };
 
-extern Controllers controllers;
-
 #endif
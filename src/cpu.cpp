@@ -1,30 +1,12 @@
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
 
 #include "cpu.h"
-
-Cpu cpu;
-
-
-static uint8_t hi_byte(uint16_t addr)
-{
-	return addr >> 8;
-}
-
-static uint8_t lo_byte(uint16_t addr)
-{
-	return (uint8_t)addr;
-}
-
-static uint16_t as_addr(uint8_t hi, uint8_t lo)
-{
-	return (hi << 8) | lo;
-}
-
-static bool pages_differ(uint16_t addr1, uint16_t addr2)
-{
-	return (addr1 & 0xFF00) != (addr2 & 0xFF00);
-}
+#include "cpu_exec.h"
+#include "jit.h"
+#include "recompiled.h"
+#include "nesemu.h"
 
 Cpu_snapshot::Cpu_snapshot(
 	uint16_t pc, std::vector<uint8_t> instr, uint8_t a,
@@ -85,40 +67,179 @@ std::string Cpu_snapshot::str() const
 	return strm.str();
 }
 
-Op::Op()
-	: valid(false)
-	, instr(Instruction::nop)
-	, mode(Mode::implied)
-	, base_cycle(0)
-	, penalty(Penalty::none)
-{}
+Cpu::Cpu(Console& console)
+	: memory(console.memory)
+	, ppu(console.ppu)
+	, scheduler(console.scheduler)
+{
+	a = x = y = 0;
+	set_status(0);
+	program_counter = 0;
+	stack_ptr = 0xFF;
+	time = 0;
+	cycle_stall = 0;
+	instructions = 0;
+	idle_stats = Idle_stats{};
+	recompiled = nullptr;
+	idle_skip = true;
+	idle.valid = false;
+	idle.armed = false;
+	idle_rejected = 0;
+	invalidate(decode_cache_base, decoded.size());
+}
 
-Op::Op(Instruction instr, Mode mode, unsigned base_cycle, Penalty penalty)
-	: valid(true)
-	, instr(instr)
-	, mode(mode)
-	, base_cycle(base_cycle)
-	, penalty(penalty)
-{}
+Cpu::~Cpu() = default;
 
+const Op& Cpu::op_info(uint8_t opcode)
+{
+	return ops[opcode];
+}
 
-bool Op::operator==(const Op& other) const
+void Cpu::set_jit(bool enabled)
 {
-	return valid == other.valid
-		&& instr == other.instr
-		&& mode == other.mode
-		&& base_cycle == other.base_cycle
-		&& penalty == other.penalty;
+	if (!enabled) {
+		jit.reset();
+	} else if (!jit && Jit::available()) {
+		jit.reset(new Jit{ *this });
+	}
 }
 
-Cpu::Cpu()
+void Cpu::set_recompiled(const Recompiled* rom)
 {
-	a = x = y = 0;
-	status.raw = 0;
-	program_counter = 0;
-	stack_ptr = 0xFF;
-	cycle = 0;
-	cycle_stall = 0;
+	recompiled = rom;
+}
+
+void Cpu::set_idle_skip(bool enabled)
+{
+	idle_skip = enabled;
+	idle.valid = false;
+	idle.armed = false;
+}
+
+void Cpu::end_frame()
+{
+	idle_stats.last_frame = idle_stats.this_frame;
+	idle_stats.this_frame = 0;
+}
+
+/* Whether the code at head is a loop back to head (through a conditional
+ * branch or JMP) that has no effect besides registers and flags, and only
+ * reads memory that cannot change under it except through the PPU. */
+bool Cpu::find_idle_loop(uint16_t head, uint16_t& end)
+{
+	uint16_t addr = head;
+
+	while ((uint16_t)(addr - head) < max_idle_loop_size) {
+		auto size = get_arg_size(ops[memory.read(addr)].mode) + 1;
+		for (unsigned i = 0; i < size; i++) {
+			if (!memory.direct(addr + i, false)) {
+				return false;
+			}
+		}
+
+		const auto& op = ops[memory.read(addr)];
+		auto operand = size == 3 ? memory.read_addr(addr + 1) : memory.read(addr + 1);
+		uint16_t next = addr + size;
+
+		switch (op.instr) {
+		case Instruction::bcs: case Instruction::bcc:
+		case Instruction::beq: case Instruction::bne:
+		case Instruction::bmi: case Instruction::bpl:
+		case Instruction::bvs: case Instruction::bvc:
+			if ((uint16_t)(next + (int8_t)operand) == head) {
+				end = addr;
+				return true;
+			}
+			break;
+		case Instruction::jmp:
+			if (op.mode == Mode::absolute && operand == head) {
+				end = addr;
+				return true;
+			}
+			return false;
+		case Instruction::lda: case Instruction::ldx: case Instruction::ldy:
+		case Instruction::bit: case Instruction::cmp: case Instruction::cpx:
+		case Instruction::cpy: case Instruction::and_: case Instruction::ora:
+		case Instruction::eor: case Instruction::adc: case Instruction::sbc:
+			switch (op.mode) {
+			case Mode::immediate:
+			case Mode::zero_page:
+				break;
+			case Mode::absolute:
+				// RAM, ROM or PPUSTATUS (reading it twice in a row is harmless)
+				if (!memory.direct(operand, false)
+					&& !(BETWEEN(operand, 0x2000, 0x4000) && operand % 8 == 2)) {
+					return false;
+				}
+				break;
+			default:
+				return false;
+			}
+			break;
+		case Instruction::asl: case Instruction::lsr:
+		case Instruction::rol: case Instruction::ror:
+			if (op.mode != Mode::accumulator) {
+				return false;
+			}
+			break;
+		case Instruction::nop:
+		case Instruction::inx: case Instruction::iny:
+		case Instruction::dex: case Instruction::dey:
+		case Instruction::clc: case Instruction::cld: case Instruction::cli:
+		case Instruction::clv: case Instruction::sec: case Instruction::sed:
+		case Instruction::sei:
+		case Instruction::tax: case Instruction::tay: case Instruction::txa:
+		case Instruction::tya: case Instruction::txs: case Instruction::tsx:
+			break;
+		default:
+			return false;
+		}
+
+		addr = next;
+	}
+
+	return false;
+}
+
+/* Called on arrival at the head of the idle loop, returns the PPU dots
+ * fast-forwarded (0 if the loop has to be interpreted this time). */
+unsigned Cpu::skip_idle()
+{
+	// the PPU may be behind in a scheduler batch
+	ppu.run_until(time);
+	auto ppu_status = ppu.peek_status();
+
+	if (idle.armed
+		&& idle.a == a && idle.x == x && idle.y == y
+		&& idle.stack_ptr == stack_ptr && idle.status == get_status()
+		&& idle.ppu_status == ppu_status) {
+		// the last iteration came back to the same state, so every further
+		// one will as long as the PPU does not change what they read
+		auto iteration = time - idle.arrived_at;
+		auto iterations = ppu.dots_until_event() * ppu_dot_ticks / iteration;
+		if (iterations > 0) {
+			auto ticks = iterations * iteration;
+			auto retired = iterations * (instructions - idle.instructions_at);
+			idle.arrived_at += ticks;
+			idle.instructions_at += retired;
+			instructions += retired;
+			time += ticks;
+			idle_stats.total += ticks / cpu_cycle_ticks;
+			idle_stats.this_frame += ticks / cpu_cycle_ticks;
+			return ticks / ppu_dot_ticks;
+		}
+	}
+
+	idle.armed = true;
+	idle.a = a;
+	idle.x = x;
+	idle.y = y;
+	idle.stack_ptr = stack_ptr;
+	idle.status = get_status();
+	idle.ppu_status = ppu_status;
+	idle.arrived_at = time;
+	idle.instructions_at = instructions;
+	return 0;
 }
 
 void Cpu::push(uint8_t value)
@@ -162,7 +283,7 @@ void Cpu::do_int()
 	}
 
 	push_addr(program_counter);
-	push(status.raw | BIT(4) | BIT(5));
+	push(get_status() | BIT(4) | BIT(5));
 
 	switch (interrupt) {
 	case Interrupt::irq:
@@ -175,16 +296,16 @@ void Cpu::do_int()
 		break;
 	}
 
-	status.break_ = 1;
-	status.interrupt_disable = 1;
-	cycle = (cycle + 7) % cpu_cycle_wraparound;
+	flags.unused_bits |= BIT(4);
+	flags.interrupt_disable = 1;
+	time += 7 * cpu_cycle_ticks;
 	this->interrupt = Interrupt::none;
 }
 
 void Cpu::trigger(Interrupt interrupt)
 {
 	LOG("interrupt triggered");
-	if (interrupt == Interrupt::nmi || !status.interrupt_disable) {
+	if (interrupt == Interrupt::nmi || !flags.interrupt_disable) {
 		this->interrupt = interrupt;
 	}
 }
@@ -196,649 +317,141 @@ void Cpu::stall(unsigned cycles)
 
 uint8_t Cpu::peek_arg()
 {
-	return memory.read(program_counter + 1);
+	return operand;
 }
 
 uint16_t Cpu::peek_addr_arg()
 {
-	return as_addr(
-		memory.read(program_counter + 2),
-		memory.read(program_counter + 1)
-	);
+	return operand;
 }
 
-void Cpu::zn(uint8_t val)
+uint8_t Cpu::get_status() const
 {
-	status.zero = !val;
-	status.negative = val & BIT(7) ? 1 : 0;
+	Status_register status;
+	status.raw = flags.unused_bits;
+	status.carry = flags.carry;
+	status.zero = !flags.zero_result;
+	status.interrupt_disable = flags.interrupt_disable;
+	status.decimal_mode = flags.decimal_mode;
+	status.overflow = flags.overflow;
+	status.negative = flags.negative_result >> 7;
+	return status.raw;
 }
 
-Extended_addr Cpu::get_addr(Mode mode)
+void Cpu::set_status(uint8_t value)
 {
-	Extended_addr addr;
-	page_crossed = false;
+	Status_register status;
+	status.raw = value;
+	flags.carry = status.carry;
+	flags.zero_result = !status.zero;
+	flags.interrupt_disable = status.interrupt_disable;
+	flags.decimal_mode = status.decimal_mode;
+	flags.overflow = status.overflow;
+	flags.negative_result = status.negative << 7;
+	flags.unused_bits = value & (BIT(4) | BIT(5));
+}
 
-	switch (mode) {
-	case Mode::implied:
-		addr = 0;
-		break;
-	case Mode::accumulator:
-		addr = a_register_ext_addr;
-		break;
-	case Mode::immediate:
-		addr = program_counter + 1;
-		break;
-	case Mode::relative:
-		addr = program_counter + (int8_t)peek_arg() + 2;
-		page_crossed = pages_differ(program_counter + 2, addr);
-		break;
-	case Mode::zero_page:
-		addr = peek_arg();
-		break;
-	case Mode::zero_page_x:
-		addr = (peek_arg() + x) % page_size;
-		break;
-	case Mode::zero_page_y:
-		addr = (peek_arg() + y) % page_size;
-		break;
-	case Mode::absolute:
-		addr = peek_addr_arg();
-		break;
-	case Mode::absolute_x:
-		addr = (peek_addr_arg() + x) % memory_size;
-		page_crossed = pages_differ(peek_addr_arg(), addr);
-		break;
-	case Mode::absolute_y:
-		addr = (peek_addr_arg() + y) % memory_size;
-		page_crossed = pages_differ(peek_addr_arg(), addr);
-		break;
-	case Mode::indirect:
-		addr = read_addr_from_mem(peek_addr_arg());
-		break;
-	case Mode::indirect_x:
-		addr = as_addr(
-			memory.read((peek_arg() + x + 1) % page_size),
-			memory.read((peek_arg() + x) % page_size)
-		);
-		page_crossed = pages_differ(addr - x, addr);
+
+Cpu::Decoded_op Cpu::decode(uint16_t addr)
+{
+	Decoded_op op{ memory.read(addr), false, 0 };
+
+	switch (get_arg_size(ops[op.opcode].mode)) {
+	case 1:
+		op.operand = memory.read(addr + 1);
 		break;
-	case Mode::indirect_y:
-		addr = (as_addr(
-			memory.read((peek_arg() + 1) % page_size),
-			memory.read(peek_arg())
-		) + y) % memory_size;
-		page_crossed = pages_differ(addr - y, addr);
+	case 2:
+		op.operand = as_addr(memory.read(addr + 2), memory.read(addr + 1));
 		break;
 	}
 
-	return addr;
-}
-
-unsigned Cpu::get_arg_size(Mode mode)
-{
-	switch (mode) {
-	case Mode::implied:
-	case Mode::accumulator:
-		return 0;
-	case Mode::immediate:
-	case Mode::relative:
-	case Mode::zero_page:
-	case Mode::zero_page_x:
-	case Mode::zero_page_y:
-	case Mode::indirect_x:
-	case Mode::indirect_y:
-		return 1;
-	case Mode::absolute:
-	case Mode::absolute_x:
-	case Mode::absolute_y:
-	case Mode::indirect:
-		return 2;
-	}
+	return op;
 }
 
-void Cpu::exec_instr(Instruction instr, Extended_addr addr)
+/* Decode the straight-line run of ROM code starting at addr,
+ * up to and including the next control flow instruction. */
+void Cpu::decode_block(uint16_t addr)
 {
-	jumped = false;
-
-	switch (instr) {
-	case Instruction::nop:
-		break;
-	case Instruction::inc:
-		memory.write(addr, memory.read(addr) + 1);
-		zn(memory.read(addr));
-		break;
-	case Instruction::inx:
-		++x;
-		zn(x);
-		break;
-	case Instruction::iny:
-		++y;
-		zn(y);
-		break;
-	case Instruction::dec:
-		memory.write(addr, memory.read(addr) - 1);
-		zn(memory.read(addr));
-		break;
-	case Instruction::dex:
-		--x;
-		zn(x);
-		break;
-	case Instruction::dey:
-		--y;
-		zn(y);
-		break;
-	case Instruction::clc:
-		status.carry = 0;
-		break;
-	case Instruction::cld:
-		status.decimal_mode = 0;
-		break;
-	case Instruction::cli:
-		status.interrupt_disable = 0;
-		break;
-	case Instruction::clv:
-		status.overflow = 0;
-		break;
-	case Instruction::sec:
-		status.carry = 1;
-		break;
-	case Instruction::sed:
-		status.decimal_mode = 1;
-		break;
-	case Instruction::sei:
-		status.interrupt_disable = 1;
-		break;
-	case Instruction::tax:
-		zn(x = a);
-		break;
-	case Instruction::tay:
-		zn(y = a);
-		break;
-	case Instruction::txa:
-		zn(a = x);
-		break;
-	case Instruction::tya:
-		zn(a = y);
-		break;
-	case Instruction::txs:
-		stack_ptr = x;
-		break;
-	case Instruction::tsx:
-		zn(x = stack_ptr);
-		break;
-	case Instruction::php:
-		push(status.raw | BIT(4) | BIT(5));
-		break;
-	case Instruction::pha:
-		push(a);
-		break;
-	case Instruction::plp:
-		status.raw = (pull() & ~BIT(4)) | BIT(5);
-		break;
-	case Instruction::pla:
-		zn(a = pull());
-		break;
-	case Instruction::bcs:
-		if (status.carry) {
-			program_counter = addr;
-			jumped = true;
-		}
-		break;
-	case Instruction::bcc:
-		if (!status.carry) {
-			program_counter = addr;
-			jumped = true;
+	for (;;) {
+		auto& entry = decoded[addr - decode_cache_base];
+		if (entry.cached || !memory.immutable(addr)) {
+			return;
 		}
-		break;
-	case Instruction::beq:
-		if (status.zero) {
-			program_counter = addr;
-			jumped = true;
-		}
-		break;
-	case Instruction::bne:
-		if (!status.zero) {
-			program_counter = addr;
-			jumped = true;
-		}
-		break;
-	case Instruction::bmi:
-		if (status.negative) {
-			program_counter = addr;
-			jumped = true;
+
+		const auto& op = ops[memory.read(addr)];
+		auto size = get_arg_size(op.mode) + 1;
+		if (!op.valid
+			|| addr + size > memory_size
+			|| !memory.immutable(addr + size - 1)) {
+			return;
 		}
-		break;
-	case Instruction::bpl:
-		if (!status.negative) {
-			program_counter = addr;
-			jumped = true;
+
+		entry = decode(addr);
+		entry.cached = true;
+
+		if (ends_block(op.instr)) {
+			return;
 		}
-		break;
-	case Instruction::bvs:
-		if (status.overflow) {
-			program_counter = addr;
-			jumped = true;
+		addr += size;
+	}
+}
+
+const Cpu::Decoded_op& Cpu::fetch()
+{
+	if (program_counter >= decode_cache_base) {
+		const auto& entry = decoded[program_counter - decode_cache_base];
+		if (!entry.cached) {
+			decode_block(program_counter);
 		}
-		break;
-	case Instruction::bvc:
-		if (!status.overflow) {
-			program_counter = addr;
-			jumped = true;
+		if (entry.cached) {
+			return entry;
 		}
-		break;
-	case Instruction::lda:
-		zn(a = memory.read(addr));
-		break;
-	case Instruction::ldx:
-		zn(x = memory.read(addr));
-		break;
-	case Instruction::ldy:
-		zn(y = memory.read(addr));
-		break;
-	case Instruction::sta:
-		memory.write(addr, a);
-		break;
-	case Instruction::stx:
-		memory.write(addr, x);
-		break;
-	case Instruction::sty:
-		memory.write(addr, y);
-		break;
-	case Instruction::bit:
-	{
-		auto m = memory.read(addr);
-		status.zero = (a & m) == 0;
-		status.overflow = (m >> 6) & 1;
-		status.negative = (m >> 7) & 1;
-		break;
-	}
-	case Instruction::cmp:
-	{
-		auto m = memory.read(addr);
-		status.carry = a >= m;
-		status.zero = a == m;
-		status.negative = ((a - m) >> 7) & 1;
-		break;
-	}
-	case Instruction::cpx:
-	{
-		auto m = memory.read(addr);
-		status.carry = x >= m;
-		status.zero = x == m;
-		status.negative = ((x - m) >> 7) & 1;
-		break;
 	}
-	case Instruction::cpy:
-	{
-		auto m = memory.read(addr);
-		status.carry = y >= m;
-		status.zero = y == m;
-		status.negative = ((y - m) >> 7) & 1;
-		break;
-	}
-	case Instruction::and_:
-		zn(a &= memory.read(addr));
-		break;
-	case Instruction::ora:
-		zn(a |= memory.read(addr));
-		break;
-	case Instruction::eor:
-		zn(a ^= memory.read(addr));
-		break;
-	case Instruction::asl:
-		status.carry = memory.read(addr) & BIT(7) ? 1 : 0;
-		memory.write(addr, memory.read(addr) << 1);
-		zn(memory.read(addr));
-		break;
-	case Instruction::lsr:
-		status.carry = memory.read(addr) & BIT(0) ? 1 : 0;
-		memory.write(addr, memory.read(addr) >> 1);
-		zn(memory.read(addr));
-		break;
-	case Instruction::rol:
-	{
-		auto old_carry = status.carry;
-		status.carry = memory.read(addr) & BIT(7) ? 1 : 0;
-		memory.write(addr, memory.read(addr) << 1 | old_carry);
-		zn(memory.read(addr));
-		break;
-	}
-	case Instruction::ror:
-	{
-		auto old_carry = status.carry;
-		status.carry = memory.read(addr) & BIT(0) ? 1 : 0;
-		memory.write(addr, memory.read(addr) >> 1 | old_carry << 7);
-		zn(memory.read(addr));
-		break;
-	}
-	case Instruction::adc:
-	{
-		auto old_a = a;
-		zn(a += memory.read(addr) + status.carry);
-		status.carry = old_a + memory.read(addr) + status.carry > 0xFF;
-		status.overflow = !((old_a ^ memory.read(addr)) & BIT(7)) && ((old_a ^ a) & BIT(7));
-		break;
-	}
-	case Instruction::sbc:
-	{
-		auto old_a = a;
-		zn(a -= memory.read(addr) + !status.carry);
-		status.carry = old_a - memory.read(addr) - !status.carry >= 0x00;
-		status.overflow = (old_a ^ memory.read(addr)) & BIT(7) && ((old_a ^ a) & BIT(7));
-		break;
+
+	uncached = decode(program_counter);
+	return uncached;
+}
+
+void Cpu::invalidate(uint16_t addr, size_t size)
+{
+	// an instruction starting up to two bytes earlier may overlap the range
+	size_t begin = std::max<size_t>(addr, decode_cache_base + 2) - 2;
+	size_t end = std::min<size_t>(addr + size, memory_size);
+	for (auto i = begin; i < end; ++i) {
+		decoded[i - decode_cache_base].cached = false;
 	}
-	case Instruction::jmp:
-		program_counter = addr;
-		jumped = true;
-		break;
-	case Instruction::jsr:
-		push_addr(program_counter + 2);
-		program_counter = addr;
-		jumped = true;
-		break;
-	case Instruction::rts:
-		program_counter = pull_addr() + 1;
-		jumped = true;
-		break;
-	case Instruction::brk:
-		program_counter++;
-		push_addr(program_counter);
-		push(status.raw | BIT(4) | BIT(5));
-		status.break_ = 1;
-		program_counter = read_addr_from_mem(irq_vec_addr);
-		jumped = true;
-		break;
-	case Instruction::rti:
-		status.raw = (pull() & ~BIT(4)) | BIT(5);
-		program_counter = pull_addr();
-		jumped = true;
-		break;
+
+	if (jit && begin < end) {
+		jit->flush();
 	}
+
+	// the code of the idle loop may be gone
+	idle.valid = false;
+	idle.armed = false;
 }
 
-static const std::array<Op, 0x100> ops = {
-	Op{ Instruction::brk, Mode::implied, 7, Penalty::none },
-	Op{ Instruction::ora, Mode::indirect_x, 6, Penalty::none },
-	invalid_op,
-	invalid_op,
-	Op{ Instruction::nop, Mode::zero_page, 3, Penalty::none },
-	Op{ Instruction::ora, Mode::zero_page, 3, Penalty::none },
-	Op{ Instruction::asl, Mode::zero_page, 5, Penalty::none },
-	invalid_op,
-	Op{ Instruction::php, Mode::implied, 3, Penalty::none },
-	Op{ Instruction::ora, Mode::immediate, 2, Penalty::none },
-	Op{ Instruction::asl, Mode::accumulator, 2, Penalty::none },
-	invalid_op,
-	Op{ Instruction::nop, Mode::absolute, 4, Penalty::none },
-	Op{ Instruction::ora, Mode::absolute, 4, Penalty::none },
-	Op{ Instruction::asl, Mode::absolute, 6, Penalty::none },
-	invalid_op,
-
-	Op{ Instruction::bpl, Mode::relative, 2, Penalty::branch },
-	Op{ Instruction::ora, Mode::indirect_y, 5, Penalty::page_cross },
-	invalid_op,
-	invalid_op,
-	Op{ Instruction::nop, Mode::zero_page_x, 4, Penalty::none },
-	Op{ Instruction::ora, Mode::zero_page_x, 4, Penalty::none },
-	Op{ Instruction::asl, Mode::zero_page_x, 6, Penalty::none },
-	invalid_op,
-	Op{ Instruction::clc, Mode::implied, 2, Penalty::none },
-	Op{ Instruction::ora, Mode::absolute_y, 4, Penalty::page_cross },
-	Op{ Instruction::nop, Mode::implied, 2, Penalty::none },
-	invalid_op,
-	Op{ Instruction::nop, Mode::absolute_x, 4, Penalty::page_cross },
-	Op{ Instruction::ora, Mode::absolute_x, 4, Penalty::page_cross },
-	Op{ Instruction::asl, Mode::absolute_x, 7, Penalty::none },
-	invalid_op,
-
-	Op{ Instruction::jsr, Mode::absolute, 6, Penalty::none },
-	Op{ Instruction::and_, Mode::indirect_x, 6, Penalty::none },
-	invalid_op,
-	invalid_op,
-	Op{ Instruction::bit, Mode::zero_page, 3, Penalty::none },
-	Op{ Instruction::and_, Mode::zero_page, 3, Penalty::none },
-	Op{ Instruction::rol, Mode::zero_page, 5, Penalty::none },
-	invalid_op,
-	Op{ Instruction::plp, Mode::implied, 4, Penalty::none },
-	Op{ Instruction::and_, Mode::immediate, 2, Penalty::none },
-	Op{ Instruction::rol, Mode::accumulator, 2, Penalty::none },
-	invalid_op,
-	Op{ Instruction::bit, Mode::absolute, 4, Penalty::none },
-	Op{ Instruction::and_, Mode::absolute, 4, Penalty::none },
-	Op{ Instruction::rol, Mode::absolute, 6, Penalty::none },
-	invalid_op,
-
-	Op{ Instruction::bmi, Mode::relative, 2, Penalty::branch },
-	Op{ Instruction::and_, Mode::indirect_y, 5, Penalty::page_cross },
-	invalid_op,
-	invalid_op,
-	Op{ Instruction::nop, Mode::zero_page_x, 4, Penalty::none },
-	Op{ Instruction::and_, Mode::zero_page_x, 4, Penalty::none },
-	Op{ Instruction::rol, Mode::zero_page_x, 6, Penalty::none },
-	invalid_op,
-	Op{ Instruction::sec, Mode::implied, 2, Penalty::none },
-	Op{ Instruction::and_, Mode::absolute_y, 4, Penalty::page_cross },
-	Op{ Instruction::nop, Mode::implied, 2, Penalty::none },
-	invalid_op,
-	Op{ Instruction::nop, Mode::absolute_x, 4, Penalty::page_cross },
-	Op{ Instruction::and_, Mode::absolute_x, 4, Penalty::page_cross },
-	Op{ Instruction::rol, Mode::absolute_x, 7, Penalty::none },
-	invalid_op,
-
-	Op{ Instruction::rti, Mode::implied, 6, Penalty::none },
-	Op{ Instruction::eor, Mode::indirect_x, 6, Penalty::none },
-	invalid_op,
-	invalid_op,
-	Op{ Instruction::nop, Mode::zero_page, 3, Penalty::none },
-	Op{ Instruction::eor, Mode::zero_page, 3, Penalty::none },
-	Op{ Instruction::lsr, Mode::zero_page, 5, Penalty::none },
-	invalid_op,
-	Op{ Instruction::pha, Mode::implied, 3, Penalty::none },
-	Op{ Instruction::eor, Mode::immediate, 2, Penalty::none },
-	Op{ Instruction::lsr, Mode::accumulator, 2, Penalty::none },
-	invalid_op,
-	Op{ Instruction::jmp, Mode::absolute, 3, Penalty::none },
-	Op{ Instruction::eor, Mode::absolute, 4, Penalty::none },
-	Op{ Instruction::lsr, Mode::absolute, 6, Penalty::none },
-	invalid_op,
-
-	Op{ Instruction::bvc, Mode::relative, 2, Penalty::branch },
-	Op{ Instruction::eor, Mode::indirect_y, 5, Penalty::page_cross },
-	invalid_op,
-	invalid_op,
-	Op{ Instruction::nop, Mode::zero_page_x, 4, Penalty::none },
-	Op{ Instruction::eor, Mode::zero_page_x, 4, Penalty::none },
-	Op{ Instruction::lsr, Mode::zero_page_x, 6, Penalty::none },
-	invalid_op,
-	Op{ Instruction::cli, Mode::implied, 2, Penalty::none },
-	Op{ Instruction::eor, Mode::absolute_y, 4, Penalty::page_cross },
-	Op{ Instruction::nop, Mode::implied, 2, Penalty::none },
-	invalid_op,
-	Op{ Instruction::nop, Mode::absolute_x, 4, Penalty::page_cross },
-	Op{ Instruction::eor, Mode::absolute_x, 4, Penalty::page_cross },
-	Op{ Instruction::lsr, Mode::absolute_x, 7, Penalty::none },
-	invalid_op,
-
-	Op{ Instruction::rts, Mode::implied, 6, Penalty::none },
-	Op{ Instruction::adc, Mode::indirect_x, 6, Penalty::none },
-	invalid_op,
-	invalid_op,
-	Op{ Instruction::nop, Mode::zero_page, 3, Penalty::none },
-	Op{ Instruction::adc, Mode::zero_page, 3, Penalty::none },
-	Op{ Instruction::ror, Mode::zero_page, 5, Penalty::none },
-	invalid_op,
-	Op{ Instruction::pla, Mode::implied, 4, Penalty::none },
-	Op{ Instruction::adc, Mode::immediate, 2, Penalty::none },
-	Op{ Instruction::ror, Mode::accumulator, 2, Penalty::none },
-	invalid_op,
-	Op{ Instruction::jmp, Mode::indirect, 5, Penalty::none },
-	Op{ Instruction::adc, Mode::absolute, 4, Penalty::none },
-	Op{ Instruction::ror, Mode::absolute, 6, Penalty::none },
-	invalid_op,
-
-	Op{ Instruction::bvs, Mode::relative, 2, Penalty::branch },
-	Op{ Instruction::adc, Mode::indirect_y, 5, Penalty::page_cross },
-	invalid_op,
-	invalid_op,
-	Op{ Instruction::nop, Mode::zero_page_x, 4, Penalty::none },
-	Op{ Instruction::adc, Mode::zero_page_x, 4, Penalty::none },
-	Op{ Instruction::ror, Mode::zero_page_x, 6, Penalty::none },
-	invalid_op,
-	Op{ Instruction::sei, Mode::implied, 2, Penalty::none },
-	Op{ Instruction::adc, Mode::absolute_y, 4, Penalty::page_cross },
-	Op{ Instruction::nop, Mode::implied, 2, Penalty::none },
-	invalid_op,
-	Op{ Instruction::nop, Mode::absolute_x, 4, Penalty::page_cross },
-	Op{ Instruction::adc, Mode::absolute_x, 4, Penalty::page_cross },
-	Op{ Instruction::ror, Mode::absolute_x, 7, Penalty::none },
-	invalid_op,
-
-	Op{ Instruction::nop, Mode::immediate, 2, Penalty::none },
-	Op{ Instruction::sta, Mode::indirect_x, 6, Penalty::none },
-	Op{ Instruction::nop, Mode::immediate, 2, Penalty::none },
-	invalid_op,
-	Op{ Instruction::sty, Mode::zero_page, 3, Penalty::none },
-	Op{ Instruction::sta, Mode::zero_page, 3, Penalty::none },
-	Op{ Instruction::stx, Mode::zero_page, 3, Penalty::none },
-	invalid_op,
-	Op{ Instruction::dey, Mode::implied, 2, Penalty::none },
-	Op{ Instruction::nop, Mode::immediate, 2, Penalty::none },
-	Op{ Instruction::txa, Mode::implied, 2, Penalty::none },
-	invalid_op,
-	Op{ Instruction::sty, Mode::absolute, 4, Penalty::none },
-	Op{ Instruction::sta, Mode::absolute, 4, Penalty::none },
-	Op{ Instruction::stx, Mode::absolute, 4, Penalty::none },
-	invalid_op,
-
-	Op{ Instruction::bcc, Mode::relative, 2, Penalty::branch },
-	Op{ Instruction::sta, Mode::indirect_y, 6, Penalty::none },
-	invalid_op,
-	invalid_op,
-	Op{ Instruction::sty, Mode::zero_page_x, 4, Penalty::none },
-	Op{ Instruction::sta, Mode::zero_page_x, 4, Penalty::none },
-	Op{ Instruction::stx, Mode::zero_page_y, 4, Penalty::none },
-	invalid_op,
-	Op{ Instruction::tya, Mode::implied, 2, Penalty::none },
-	Op{ Instruction::sta, Mode::absolute_y, 5, Penalty::none },
-	Op{ Instruction::txs, Mode::implied, 2, Penalty::none },
-	invalid_op,
-	invalid_op,
-	Op{ Instruction::sta, Mode::absolute_x, 5, Penalty::none },
-	invalid_op,
-	invalid_op,
-
-	Op{ Instruction::ldy, Mode::immediate, 2, Penalty::none },
-	Op{ Instruction::lda, Mode::indirect_x, 6, Penalty::none },
-	Op{ Instruction::ldx, Mode::immediate, 2, Penalty::none },
-	invalid_op,
-	Op{ Instruction::ldy, Mode::zero_page, 3, Penalty::none },
-	Op{ Instruction::lda, Mode::zero_page, 3, Penalty::none },
-	Op{ Instruction::ldx, Mode::zero_page, 3, Penalty::none },
-	invalid_op,
-	Op{ Instruction::tay, Mode::implied, 2, Penalty::none },
-	Op{ Instruction::lda, Mode::immediate, 2, Penalty::none },
-	Op{ Instruction::tax, Mode::implied, 2, Penalty::none },
-	invalid_op,
-	Op{ Instruction::ldy, Mode::absolute, 4, Penalty::none },
-	Op{ Instruction::lda, Mode::absolute, 4, Penalty::none },
-	Op{ Instruction::ldx, Mode::absolute, 4, Penalty::none },
-	invalid_op,
-
-	Op{ Instruction::bcs, Mode::relative, 2, Penalty::branch },
-	Op{ Instruction::lda, Mode::indirect_y, 5, Penalty::page_cross },
-	invalid_op,
-	invalid_op,
-	Op{ Instruction::ldy, Mode::zero_page_x, 4, Penalty::none },
-	Op{ Instruction::lda, Mode::zero_page_x, 4, Penalty::none },
-	Op{ Instruction::ldx, Mode::zero_page_y, 4, Penalty::none },
-	invalid_op,
-	Op{ Instruction::clv, Mode::implied, 2, Penalty::none },
-	Op{ Instruction::lda, Mode::absolute_y, 4, Penalty::page_cross },
-	Op{ Instruction::tsx, Mode::implied, 2, Penalty::none },
-	invalid_op,
-	Op{ Instruction::ldy, Mode::absolute_x, 4, Penalty::page_cross },
-	Op{ Instruction::lda, Mode::absolute_x, 4, Penalty::page_cross },
-	Op{ Instruction::ldx, Mode::absolute_y, 4, Penalty::page_cross },
-	invalid_op,
-
-	Op{ Instruction::cpy, Mode::immediate, 2, Penalty::none },
-	Op{ Instruction::cmp, Mode::indirect_x, 6, Penalty::none },
-	Op{ Instruction::nop, Mode::immediate, 2, Penalty::none },
-	invalid_op,
-	Op{ Instruction::cpy, Mode::zero_page, 3, Penalty::none },
-	Op{ Instruction::cmp, Mode::zero_page, 3, Penalty::none },
-	Op{ Instruction::dec, Mode::zero_page, 5, Penalty::none },
-	invalid_op,
-	Op{ Instruction::iny, Mode::implied, 2, Penalty::none },
-	Op{ Instruction::cmp, Mode::immediate, 2, Penalty::none },
-	Op{ Instruction::dex, Mode::implied, 2, Penalty::none },
-	invalid_op,
-	Op{ Instruction::cpy, Mode::absolute, 4, Penalty::none },
-	Op{ Instruction::cmp, Mode::absolute, 4, Penalty::none },
-	Op{ Instruction::dec, Mode::absolute, 6, Penalty::none },
-	invalid_op,
-
-	Op{ Instruction::bne, Mode::relative, 2, Penalty::branch },
-	Op{ Instruction::cmp, Mode::indirect_y, 5, Penalty::page_cross },
-	invalid_op,
-	invalid_op,
-	Op{ Instruction::nop, Mode::zero_page_x, 4, Penalty::none },
-	Op{ Instruction::cmp, Mode::zero_page_x, 4, Penalty::none },
-	Op{ Instruction::dec, Mode::zero_page_x, 6, Penalty::none },
-	invalid_op,
-	Op{ Instruction::cld, Mode::implied, 2, Penalty::none },
-	Op{ Instruction::cmp, Mode::absolute_y, 4, Penalty::page_cross },
-	Op{ Instruction::nop, Mode::implied, 2, Penalty::none },
-	invalid_op,
-	Op{ Instruction::nop, Mode::absolute_x, 4, Penalty::page_cross },
-	Op{ Instruction::cmp, Mode::absolute_x, 4, Penalty::page_cross },
-	Op{ Instruction::dec, Mode::absolute_x, 7, Penalty::none },
-	invalid_op,
-
-	Op{ Instruction::cpx, Mode::immediate, 2, Penalty::none },
-	Op{ Instruction::sbc, Mode::indirect_x, 6, Penalty::none },
-	Op{ Instruction::nop, Mode::immediate, 2, Penalty::none },
-	invalid_op,
-	Op{ Instruction::cpx, Mode::zero_page, 3, Penalty::none },
-	Op{ Instruction::sbc, Mode::zero_page, 3, Penalty::none },
-	Op{ Instruction::inc, Mode::zero_page, 5, Penalty::none },
-	invalid_op,
-	Op{ Instruction::inx, Mode::implied, 2, Penalty::none },
-	Op{ Instruction::sbc, Mode::immediate, 2, Penalty::none },
-	Op{ Instruction::nop, Mode::implied, 2, Penalty::none },
-	invalid_op,
-	Op{ Instruction::cpx, Mode::absolute, 4, Penalty::none },
-	Op{ Instruction::sbc, Mode::absolute, 4, Penalty::none },
-	Op{ Instruction::inc, Mode::absolute, 6, Penalty::none },
-	invalid_op,
-
-	Op{ Instruction::beq, Mode::relative, 2, Penalty::branch },
-	Op{ Instruction::sbc, Mode::indirect_y, 5, Penalty::page_cross },
-	invalid_op,
-	invalid_op,
-	Op{ Instruction::nop, Mode::zero_page_x, 4, Penalty::none },
-	Op{ Instruction::sbc, Mode::zero_page_x, 4, Penalty::none },
-	Op{ Instruction::inc, Mode::zero_page_x, 6, Penalty::none },
-	invalid_op,
-	Op{ Instruction::sed, Mode::implied, 2, Penalty::none },
-	Op{ Instruction::sbc, Mode::absolute_y, 4, Penalty::page_cross },
-	Op{ Instruction::nop, Mode::implied, 2, Penalty::none },
-	invalid_op,
-	Op{ Instruction::nop, Mode::absolute_x, 4, Penalty::page_cross },
-	Op{ Instruction::sbc, Mode::absolute_x, 4, Penalty::page_cross },
-	Op{ Instruction::inc, Mode::absolute_x, 7, Penalty::none },
-	invalid_op
-};
-
-const Op& Cpu::get_op(uint8_t opcode)
-{
-	const auto& op = ops[opcode];
-	if (op == invalid_op) {
-		GLOBAL_ERROR(std::to_string(opcode).c_str());
-	}
-	return op;
+template <size_t... opcodes>
+constexpr std::array<Cpu::Handler, 0x100> Cpu::make_handlers(std::index_sequence<opcodes...>)
+{
+	return {{ &Cpu::exec_op<opcodes>... }};
+}
+
+template <size_t... opcodes>
+constexpr std::array<Cpu::Op_entry, 0x100> Cpu::make_entries(std::index_sequence<opcodes...>)
+{
+	return {{ &Cpu::entry<opcodes>... }};
 }
 
+template <size_t... opcodes>
+constexpr std::array<Cpu::Op_guard, 0x100> Cpu::make_guards(std::index_sequence<opcodes...>)
+{
+	return {{ &Cpu::direct_operand<opcodes>... }};
+}
+
+const std::array<Cpu::Handler, 0x100> Cpu::handlers = Cpu::make_handlers(std::make_index_sequence<0x100>{});
+const std::array<Cpu::Op_entry, 0x100> Cpu::op_entries = Cpu::make_entries(std::make_index_sequence<0x100>{});
+const std::array<Cpu::Op_guard, 0x100> Cpu::op_guards = Cpu::make_guards(std::make_index_sequence<0x100>{});
+
 unsigned Cpu::step()
 {
 #if LOGGING_ENABLED
@@ -852,46 +465,74 @@ unsigned Cpu::step()
 #endif
 
 	if (cycle_stall) {
-		cycle_stall--;
-		cycle = (cycle + 1) % cpu_cycle_wraparound; // TODO: 1 or 3?
-		return 1;
+		// nothing else happens on the bus until the DMA is over
+		unsigned dots = cycle_stall * cpu_cycle_ticks / ppu_dot_ticks;
+		time += cycle_stall * cpu_cycle_ticks;
+		cycle_stall = 0;
+		return dots;
 	}
 
-	auto start_cycle = cycle;
+	if (idle.valid && program_counter == idle.head && interrupt == Interrupt::none) {
+		auto dots = skip_idle();
+		if (dots) {
+			return dots;
+		}
+	}
 
-	do_int();
+	auto start_time = time;
 
-	unsigned penalty_sum = 0;
+	do_int();
 
-	const auto& op = get_op(memory.read(program_counter));
+	auto start_pc = program_counter;
+	auto retired = instructions;
+	// single step inside the idle loop so its arrivals at head are seen
+	bool in_idle_loop = idle.valid && BETWEEN(program_counter, idle.head, idle.end + 1);
 
-	exec_instr(op.instr, get_addr(op.mode));
+	if (recompiled && !in_idle_loop && program_counter >= decode_cache_base) {
+		auto deadline = std::min(scheduler.next(), time + Recompiled::cycle_budget * cpu_cycle_ticks);
+		recompiled->run(this, deadline);
+	}
 
-	switch (op.penalty) {
-	case Penalty::branch:
-		if (!jumped) { break; }
-		penalty_sum++;
-	case Penalty::page_cross:
-		if (page_crossed) {
-			penalty_sum++;
+	// a block only starts if it ends before the next event: the interpreter
+	// runs no instruction past it, so an NMI would arrive late otherwise
+	if (jit && !in_idle_loop && instructions == retired
+		&& time + Jit::max_block_dots * ppu_dot_ticks <= scheduler.next()) {
+		auto block = jit->block_at(program_counter);
+		if (block) {
+			block(this);
 		}
-	case Penalty::none:
-		break;
 	}
 
-	if (!jumped) {
-		program_counter += get_arg_size(op.mode) + 1;
+	// no translated code here, or it bailed out on an I/O access right away
+	if (instructions == retired) {
+		const auto& op = fetch();
+		operand = op.operand;
+		(this->*handlers[op.opcode])();
 	}
 
-	cycle = (cycle + (op.base_cycle + penalty_sum) * 3) % cpu_cycle_wraparound;
+	if (idle.valid && !BETWEEN(program_counter, idle.head, idle.end + 1)) {
+		idle.armed = false;
+	}
 
-	LOG_FMT("cycle_end=%u, cycle_begin=%u", cycle, start_cycle);
-	auto cycle_diff = (int)cycle - (int)start_cycle;
-	if (cycle_diff < 0) {
-		cycle_diff += cpu_cycle_wraparound;
+	// jumped back a little: candidate idle loop
+	if (idle_skip
+		&& program_counter <= start_pc
+		&& (unsigned)(start_pc - program_counter) < max_idle_loop_size
+		&& !(idle.valid && program_counter == idle.head)
+		&& program_counter != idle_rejected) {
+		uint16_t end;
+		if (find_idle_loop(program_counter, end)) {
+			idle = Idle_loop{};
+			idle.valid = true;
+			idle.head = program_counter;
+			idle.end = end;
+		} else {
+			idle_rejected = program_counter;
+		}
 	}
 
-	return cycle_diff;
+	LOG_FMT("time_end=%llu, time_begin=%llu", (unsigned long long)time, (unsigned long long)start_time);
+	return (time - start_time) / ppu_dot_ticks;
 }
 
 void Cpu::reset()
@@ -899,13 +540,19 @@ void Cpu::reset()
 	program_counter = read_addr_from_mem(reset_vec_addr);
 }
 
+uint64_t Cpu::cycles() const
+{
+	return time / cpu_cycle_ticks;
+}
+
 Cpu_snapshot Cpu::take_snapshot()
 {
 	auto opcode = memory.read(program_counter);
 	std::vector<uint8_t> instr{ opcode };
-	auto arg_size = get_arg_size(get_op(opcode).mode);
+	auto arg_size = get_arg_size(ops[opcode].mode);
 	for (unsigned i = 0; i < arg_size; i++) {
 		instr.push_back(memory.read(program_counter + 1 + i));
 	}
-	return Cpu_snapshot{ program_counter, instr, a, x, y, status.raw, stack_ptr, cycle };
+	return Cpu_snapshot{ program_counter, instr, a, x, y, get_status(), stack_ptr,
+		(unsigned)(time / ppu_dot_ticks % dots_per_line) };
 }
@@ -10,9 +10,15 @@
 #include <memory>
 #include <cstdint>
 #include <sstream>
+#include <utility>
 
 class Memory;
-using Extended_addr = int;
+class Ppu;
+class Scheduler;
+class Console;
+class Jit;
+class Lockstep;
+struct Recompiled;
 
 struct Cpu_snapshot {
 	const uint16_t pc;
@@ -72,13 +78,24 @@ struct Op {
 	const unsigned base_cycle;
 	const Penalty penalty;
 
-	Op();
-	Op(Instruction instr, Mode mode, unsigned base_cycle, Penalty penalty);
-
-	bool operator==(const Op& other) const;
+	constexpr Op()
+		: valid(false)
+		, instr(Instruction::nop)
+		, mode(Mode::implied)
+		, base_cycle(0)
+		, penalty(Penalty::none)
+	{}
+
+	constexpr Op(Instruction instr, Mode mode, unsigned base_cycle, Penalty penalty)
+		: valid(true)
+		, instr(instr)
+		, mode(mode)
+		, base_cycle(base_cycle)
+		, penalty(penalty)
+	{}
 };
 
-const Op invalid_op;
+constexpr Op invalid_op;
 
 class Cpu {
 public:
@@ -89,32 +106,111 @@ public:
 	uint8_t a, x, y;
 	uint8_t stack_ptr;
 	uint16_t program_counter;
-	Status_register status;
 
-	unsigned cycle;
+	/* Processor status, unpacked: a byte per flag, with Z and N kept as the
+	 * value they were last computed from. The P byte is only put together
+	 * for PHP, BRK, interrupts and snapshots, see get_status. */
+	struct Flags {
+		uint8_t carry;
+		uint8_t zero_result;      // Z is set when this is 0
+		uint8_t negative_result;  // N is its bit 7
+		uint8_t overflow;
+		uint8_t interrupt_disable;
+		uint8_t decimal_mode;
+		uint8_t unused_bits;      // B and bit 5 as last loaded
+	};
+	Flags flags;
+
+	// master clock time the CPU has run up to
+	Master_time time;
 	unsigned cycle_stall;
+	uint64_t instructions;
+
+	struct Idle_stats {
+		// CPU cycles fast-forwarded in idle loops
+		uint64_t total;
+		uint64_t this_frame;
+		uint64_t last_frame;
+	};
+	Idle_stats idle_stats;
 
-	Cpu();
+	explicit Cpu(Console& console);
+	~Cpu();
 
+	Cpu(const Cpu&) = delete;
+	Cpu& operator=(const Cpu&) = delete;
+
+	// returns the PPU dots it took
 	unsigned step();
 	void reset();
 
+	// CPU cycles run since power on
+	uint64_t cycles() const;
+
 	void trigger(Interrupt interrupt);
 	void stall(unsigned cycles);
 
+	// drop predecoded instructions overlapping [addr, addr + size)
+	void invalidate(uint16_t addr, size_t size);
+
+	// run hot ROM blocks as translated machine code, see jit.h
+	void set_jit(bool enabled);
+	// run ROM code translated ahead of time, see recompiled.h (nullptr: none)
+	void set_recompiled(const Recompiled* rom);
+	// fast-forward idle loops to the next PPU event (on by default)
+	void set_idle_skip(bool enabled);
+	// called by the PPU once per frame, rolls idle_stats over
+	void end_frame();
+
+	static const Op& op_info(uint8_t opcode);
+	static constexpr unsigned get_arg_size(Mode mode);
+	static constexpr bool ends_block(Instruction instr);
+	static constexpr bool writes_memory(Instruction instr);
+
 	Cpu_snapshot take_snapshot();
 
-	static const Extended_addr nmi_vec_addr = 0xFFFA;
-	static const Extended_addr reset_vec_addr = 0xFFFC;
-	static const Extended_addr irq_vec_addr = 0xFFFE;
+	uint8_t get_status() const;
+	void set_status(uint8_t value);
+
+	static const uint16_t nmi_vec_addr = 0xFFFA;
+	static const uint16_t reset_vec_addr = 0xFFFC;
+	static const uint16_t irq_vec_addr = 0xFFFE;
 
 private:
+	friend class Jit;
+	friend struct Recompiled;
+	friend class Lockstep;
+
+	// the rest of the console
+	Memory& memory;
+	Ppu& ppu;
+	Scheduler& scheduler;
+
 	static const uint16_t stack_page = 0x0100;
-	static const unsigned cpu_cycle_wraparound = 341;
+	// dots per scanline, for the CYC column of snapshots
+	static const unsigned dots_per_line = 341;
+
+	bool jumped = false;
+	bool page_crossed = false;
+	Interrupt interrupt = Interrupt::none;
+
+	/* Predecoded instruction. Only code in read-only (cartridge ROM)
+	 * pages is kept in the cache, RAM code is decoded on every fetch. */
+	struct Decoded_op {
+		uint8_t opcode;
+		bool cached;
+		uint16_t operand;
+	};
+
+	static const uint16_t decode_cache_base = 0x8000;
+	static const size_t decode_cache_size = 0x8000;
+	std::array<Decoded_op, decode_cache_size> decoded;
+	Decoded_op uncached;
+	uint16_t operand;
 
-	bool jumped;
-	bool page_crossed;
-	Interrupt interrupt;
+	Decoded_op decode(uint16_t addr);
+	void decode_block(uint16_t addr);
+	const Decoded_op& fetch();
 
 	void push(uint8_t value);
 	void push_addr(uint16_t value);
@@ -128,15 +224,124 @@ private:
 
 	void zn(uint8_t val);
 
-	Extended_addr get_addr(Mode mode);
-	unsigned get_arg_size(Mode mode);
-	void exec_instr(Instruction instr, Extended_addr addr);
-	const Op& get_op(uint8_t opcode);
+	using Handler = void (Cpu::*)();
+	static const std::array<Handler, 0x100> handlers;
+
+	template <size_t... opcodes>
+	static constexpr std::array<Handler, 0x100> make_handlers(std::index_sequence<opcodes...>);
+
+	// plain function entry points for translated code
+	using Op_entry = void (*)(Cpu* cpu);
+	using Op_guard = bool (*)(Cpu* cpu);
+	static const std::array<Op_entry, 0x100> op_entries;
+	static const std::array<Op_guard, 0x100> op_guards;
+
+	template <size_t... opcodes>
+	static constexpr std::array<Op_entry, 0x100> make_entries(std::index_sequence<opcodes...>);
+	template <size_t... opcodes>
+	static constexpr std::array<Op_guard, 0x100> make_guards(std::index_sequence<opcodes...>);
+
+	template <uint8_t opcode> static void entry(Cpu* cpu);
+	template <uint8_t opcode> static bool direct_operand(Cpu* cpu);
+
+	std::unique_ptr<Jit> jit;
+	const Recompiled* recompiled;
+
+	/* A short loop that only reads RAM/ROM and $2002, e.g. LDA $2002 / BPL
+	 * or waiting for the NMI handler to set a flag. Once it arrives at its
+	 * head twice in a row in the same state, whole iterations are skipped up
+	 * to the next point where the PPU could change what the loop reads. */
+	struct Idle_loop {
+		bool valid;
+		uint16_t head, end;
+		// state at the last arrival at head, if armed
+		bool armed;
+		uint8_t a, x, y, stack_ptr, status;
+		uint8_t ppu_status;
+		Master_time arrived_at;
+		uint64_t instructions_at;
+	};
+
+	static const unsigned max_idle_loop_size = 16;
+
+	bool idle_skip;
+	Idle_loop idle;
+	uint16_t idle_rejected;
+
+	bool find_idle_loop(uint16_t head, uint16_t& end);
+	unsigned skip_idle();
+
+	template <uint8_t opcode> void exec_op();
+	template <Mode mode> uint16_t get_addr();
+	template <Instruction instr, Mode mode> void exec_instr(uint16_t addr);
+	template <Mode mode> uint8_t load(uint16_t addr);
+	template <Mode mode> void store(uint16_t addr, uint8_t value);
 
 	void do_int();
 };
 
-extern Cpu cpu;
-extern Memory memory;
+constexpr unsigned Cpu::get_arg_size(Mode mode)
+{
+	switch (mode) {
+	case Mode::implied:
+	case Mode::accumulator:
+		return 0;
+	case Mode::immediate:
+	case Mode::relative:
+	case Mode::zero_page:
+	case Mode::zero_page_x:
+	case Mode::zero_page_y:
+	case Mode::indirect_x:
+	case Mode::indirect_y:
+		return 1;
+	case Mode::absolute:
+	case Mode::absolute_x:
+	case Mode::absolute_y:
+	case Mode::indirect:
+		return 2;
+	}
+	return 0;
+}
+
+constexpr bool Cpu::ends_block(Instruction instr)
+{
+	switch (instr) {
+	case Instruction::bcs:
+	case Instruction::bcc:
+	case Instruction::beq:
+	case Instruction::bne:
+	case Instruction::bmi:
+	case Instruction::bpl:
+	case Instruction::bvs:
+	case Instruction::bvc:
+	case Instruction::jmp:
+	case Instruction::jsr:
+	case Instruction::rts:
+	case Instruction::brk:
+	case Instruction::rti:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// stores to its operand (in any mode but accumulator)
+constexpr bool Cpu::writes_memory(Instruction instr)
+{
+	switch (instr) {
+	case Instruction::sta:
+	case Instruction::stx:
+	case Instruction::sty:
+	case Instruction::inc:
+	case Instruction::dec:
+	case Instruction::asl:
+	case Instruction::lsr:
+	case Instruction::rol:
+	case Instruction::ror:
+		return true;
+	default:
+		return false;
+	}
+}
 
 #endif
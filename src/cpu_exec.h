@@ -0,0 +1,714 @@
+#ifndef NESEMU_CPU_EXEC_H
+#define NESEMU_CPU_EXEC_H
+
+/* Opcode table and instruction semantics of Cpu. Shared by the interpreter
+ * (cpu.cpp) and by statically recompiled ROMs (see recompiled.h), which
+ * inline the handlers instead of dispatching through a table. */
+
+#include "cpu.h"
+
+static inline uint8_t hi_byte(uint16_t addr)
+{
+	return addr >> 8;
+}
+
+static inline uint8_t lo_byte(uint16_t addr)
+{
+	return (uint8_t)addr;
+}
+
+static inline uint16_t as_addr(uint8_t hi, uint8_t lo)
+{
+	return (hi << 8) | lo;
+}
+
+static inline bool pages_differ(uint16_t addr1, uint16_t addr2)
+{
+	return (addr1 & 0xFF00) != (addr2 & 0xFF00);
+}
+
+inline void Cpu::zn(uint8_t val)
+{
+	flags.zero_result = val;
+	flags.negative_result = val;
+}
+
+static constexpr std::array<Op, 0x100> ops = {
+	Op{ Instruction::brk, Mode::implied, 7, Penalty::none },
+	Op{ Instruction::ora, Mode::indirect_x, 6, Penalty::none },
+	invalid_op,
+	invalid_op,
+	Op{ Instruction::nop, Mode::zero_page, 3, Penalty::none },
+	Op{ Instruction::ora, Mode::zero_page, 3, Penalty::none },
+	Op{ Instruction::asl, Mode::zero_page, 5, Penalty::none },
+	invalid_op,
+	Op{ Instruction::php, Mode::implied, 3, Penalty::none },
+	Op{ Instruction::ora, Mode::immediate, 2, Penalty::none },
+	Op{ Instruction::asl, Mode::accumulator, 2, Penalty::none },
+	invalid_op,
+	Op{ Instruction::nop, Mode::absolute, 4, Penalty::none },
+	Op{ Instruction::ora, Mode::absolute, 4, Penalty::none },
+	Op{ Instruction::asl, Mode::absolute, 6, Penalty::none },
+	invalid_op,
+
+	Op{ Instruction::bpl, Mode::relative, 2, Penalty::branch },
+	Op{ Instruction::ora, Mode::indirect_y, 5, Penalty::page_cross },
+	invalid_op,
+	invalid_op,
+	Op{ Instruction::nop, Mode::zero_page_x, 4, Penalty::none },
+	Op{ Instruction::ora, Mode::zero_page_x, 4, Penalty::none },
+	Op{ Instruction::asl, Mode::zero_page_x, 6, Penalty::none },
+	invalid_op,
+	Op{ Instruction::clc, Mode::implied, 2, Penalty::none },
+	Op{ Instruction::ora, Mode::absolute_y, 4, Penalty::page_cross },
+	Op{ Instruction::nop, Mode::implied, 2, Penalty::none },
+	invalid_op,
+	Op{ Instruction::nop, Mode::absolute_x, 4, Penalty::page_cross },
+	Op{ Instruction::ora, Mode::absolute_x, 4, Penalty::page_cross },
+	Op{ Instruction::asl, Mode::absolute_x, 7, Penalty::none },
+	invalid_op,
+
+	Op{ Instruction::jsr, Mode::absolute, 6, Penalty::none },
+	Op{ Instruction::and_, Mode::indirect_x, 6, Penalty::none },
+	invalid_op,
+	invalid_op,
+	Op{ Instruction::bit, Mode::zero_page, 3, Penalty::none },
+	Op{ Instruction::and_, Mode::zero_page, 3, Penalty::none },
+	Op{ Instruction::rol, Mode::zero_page, 5, Penalty::none },
+	invalid_op,
+	Op{ Instruction::plp, Mode::implied, 4, Penalty::none },
+	Op{ Instruction::and_, Mode::immediate, 2, Penalty::none },
+	Op{ Instruction::rol, Mode::accumulator, 2, Penalty::none },
+	invalid_op,
+	Op{ Instruction::bit, Mode::absolute, 4, Penalty::none },
+	Op{ Instruction::and_, Mode::absolute, 4, Penalty::none },
+	Op{ Instruction::rol, Mode::absolute, 6, Penalty::none },
+	invalid_op,
+
+	Op{ Instruction::bmi, Mode::relative, 2, Penalty::branch },
+	Op{ Instruction::and_, Mode::indirect_y, 5, Penalty::page_cross },
+	invalid_op,
+	invalid_op,
+	Op{ Instruction::nop, Mode::zero_page_x, 4, Penalty::none },
+	Op{ Instruction::and_, Mode::zero_page_x, 4, Penalty::none },
+	Op{ Instruction::rol, Mode::zero_page_x, 6, Penalty::none },
+	invalid_op,
+	Op{ Instruction::sec, Mode::implied, 2, Penalty::none },
+	Op{ Instruction::and_, Mode::absolute_y, 4, Penalty::page_cross },
+	Op{ Instruction::nop, Mode::implied, 2, Penalty::none },
+	invalid_op,
+	Op{ Instruction::nop, Mode::absolute_x, 4, Penalty::page_cross },
+	Op{ Instruction::and_, Mode::absolute_x, 4, Penalty::page_cross },
+	Op{ Instruction::rol, Mode::absolute_x, 7, Penalty::none },
+	invalid_op,
+
+	Op{ Instruction::rti, Mode::implied, 6, Penalty::none },
+	Op{ Instruction::eor, Mode::indirect_x, 6, Penalty::none },
+	invalid_op,
+	invalid_op,
+	Op{ Instruction::nop, Mode::zero_page, 3, Penalty::none },
+	Op{ Instruction::eor, Mode::zero_page, 3, Penalty::none },
+	Op{ Instruction::lsr, Mode::zero_page, 5, Penalty::none },
+	invalid_op,
+	Op{ Instruction::pha, Mode::implied, 3, Penalty::none },
+	Op{ Instruction::eor, Mode::immediate, 2, Penalty::none },
+	Op{ Instruction::lsr, Mode::accumulator, 2, Penalty::none },
+	invalid_op,
+	Op{ Instruction::jmp, Mode::absolute, 3, Penalty::none },
+	Op{ Instruction::eor, Mode::absolute, 4, Penalty::none },
+	Op{ Instruction::lsr, Mode::absolute, 6, Penalty::none },
+	invalid_op,
+
+	Op{ Instruction::bvc, Mode::relative, 2, Penalty::branch },
+	Op{ Instruction::eor, Mode::indirect_y, 5, Penalty::page_cross },
+	invalid_op,
+	invalid_op,
+	Op{ Instruction::nop, Mode::zero_page_x, 4, Penalty::none },
+	Op{ Instruction::eor, Mode::zero_page_x, 4, Penalty::none },
+	Op{ Instruction::lsr, Mode::zero_page_x, 6, Penalty::none },
+	invalid_op,
+	Op{ Instruction::cli, Mode::implied, 2, Penalty::none },
+	Op{ Instruction::eor, Mode::absolute_y, 4, Penalty::page_cross },
+	Op{ Instruction::nop, Mode::implied, 2, Penalty::none },
+	invalid_op,
+	Op{ Instruction::nop, Mode::absolute_x, 4, Penalty::page_cross },
+	Op{ Instruction::eor, Mode::absolute_x, 4, Penalty::page_cross },
+	Op{ Instruction::lsr, Mode::absolute_x, 7, Penalty::none },
+	invalid_op,
+
+	Op{ Instruction::rts, Mode::implied, 6, Penalty::none },
+	Op{ Instruction::adc, Mode::indirect_x, 6, Penalty::none },
+	invalid_op,
+	invalid_op,
+	Op{ Instruction::nop, Mode::zero_page, 3, Penalty::none },
+	Op{ Instruction::adc, Mode::zero_page, 3, Penalty::none },
+	Op{ Instruction::ror, Mode::zero_page, 5, Penalty::none },
+	invalid_op,
+	Op{ Instruction::pla, Mode::implied, 4, Penalty::none },
+	Op{ Instruction::adc, Mode::immediate, 2, Penalty::none },
+	Op{ Instruction::ror, Mode::accumulator, 2, Penalty::none },
+	invalid_op,
+	Op{ Instruction::jmp, Mode::indirect, 5, Penalty::none },
+	Op{ Instruction::adc, Mode::absolute, 4, Penalty::none },
+	Op{ Instruction::ror, Mode::absolute, 6, Penalty::none },
+	invalid_op,
+
+	Op{ Instruction::bvs, Mode::relative, 2, Penalty::branch },
+	Op{ Instruction::adc, Mode::indirect_y, 5, Penalty::page_cross },
+	invalid_op,
+	invalid_op,
+	Op{ Instruction::nop, Mode::zero_page_x, 4, Penalty::none },
+	Op{ Instruction::adc, Mode::zero_page_x, 4, Penalty::none },
+	Op{ Instruction::ror, Mode::zero_page_x, 6, Penalty::none },
+	invalid_op,
+	Op{ Instruction::sei, Mode::implied, 2, Penalty::none },
+	Op{ Instruction::adc, Mode::absolute_y, 4, Penalty::page_cross },
+	Op{ Instruction::nop, Mode::implied, 2, Penalty::none },
+	invalid_op,
+	Op{ Instruction::nop, Mode::absolute_x, 4, Penalty::page_cross },
+	Op{ Instruction::adc, Mode::absolute_x, 4, Penalty::page_cross },
+	Op{ Instruction::ror, Mode::absolute_x, 7, Penalty::none },
+	invalid_op,
+
+	Op{ Instruction::nop, Mode::immediate, 2, Penalty::none },
+	Op{ Instruction::sta, Mode::indirect_x, 6, Penalty::none },
+	Op{ Instruction::nop, Mode::immediate, 2, Penalty::none },
+	invalid_op,
+	Op{ Instruction::sty, Mode::zero_page, 3, Penalty::none },
+	Op{ Instruction::sta, Mode::zero_page, 3, Penalty::none },
+	Op{ Instruction::stx, Mode::zero_page, 3, Penalty::none },
+	invalid_op,
+	Op{ Instruction::dey, Mode::implied, 2, Penalty::none },
+	Op{ Instruction::nop, Mode::immediate, 2, Penalty::none },
+	Op{ Instruction::txa, Mode::implied, 2, Penalty::none },
+	invalid_op,
+	Op{ Instruction::sty, Mode::absolute, 4, Penalty::none },
+	Op{ Instruction::sta, Mode::absolute, 4, Penalty::none },
+	Op{ Instruction::stx, Mode::absolute, 4, Penalty::none },
+	invalid_op,
+
+	Op{ Instruction::bcc, Mode::relative, 2, Penalty::branch },
+	Op{ Instruction::sta, Mode::indirect_y, 6, Penalty::none },
+	invalid_op,
+	invalid_op,
+	Op{ Instruction::sty, Mode::zero_page_x, 4, Penalty::none },
+	Op{ Instruction::sta, Mode::zero_page_x, 4, Penalty::none },
+	Op{ Instruction::stx, Mode::zero_page_y, 4, Penalty::none },
+	invalid_op,
+	Op{ Instruction::tya, Mode::implied, 2, Penalty::none },
+	Op{ Instruction::sta, Mode::absolute_y, 5, Penalty::none },
+	Op{ Instruction::txs, Mode::implied, 2, Penalty::none },
+	invalid_op,
+	invalid_op,
+	Op{ Instruction::sta, Mode::absolute_x, 5, Penalty::none },
+	invalid_op,
+	invalid_op,
+
+	Op{ Instruction::ldy, Mode::immediate, 2, Penalty::none },
+	Op{ Instruction::lda, Mode::indirect_x, 6, Penalty::none },
+	Op{ Instruction::ldx, Mode::immediate, 2, Penalty::none },
+	invalid_op,
+	Op{ Instruction::ldy, Mode::zero_page, 3, Penalty::none },
+	Op{ Instruction::lda, Mode::zero_page, 3, Penalty::none },
+	Op{ Instruction::ldx, Mode::zero_page, 3, Penalty::none },
+	invalid_op,
+	Op{ Instruction::tay, Mode::implied, 2, Penalty::none },
+	Op{ Instruction::lda, Mode::immediate, 2, Penalty::none },
+	Op{ Instruction::tax, Mode::implied, 2, Penalty::none },
+	invalid_op,
+	Op{ Instruction::ldy, Mode::absolute, 4, Penalty::none },
+	Op{ Instruction::lda, Mode::absolute, 4, Penalty::none },
+	Op{ Instruction::ldx, Mode::absolute, 4, Penalty::none },
+	invalid_op,
+
+	Op{ Instruction::bcs, Mode::relative, 2, Penalty::branch },
+	Op{ Instruction::lda, Mode::indirect_y, 5, Penalty::page_cross },
+	invalid_op,
+	invalid_op,
+	Op{ Instruction::ldy, Mode::zero_page_x, 4, Penalty::none },
+	Op{ Instruction::lda, Mode::zero_page_x, 4, Penalty::none },
+	Op{ Instruction::ldx, Mode::zero_page_y, 4, Penalty::none },
+	invalid_op,
+	Op{ Instruction::clv, Mode::implied, 2, Penalty::none },
+	Op{ Instruction::lda, Mode::absolute_y, 4, Penalty::page_cross },
+	Op{ Instruction::tsx, Mode::implied, 2, Penalty::none },
+	invalid_op,
+	Op{ Instruction::ldy, Mode::absolute_x, 4, Penalty::page_cross },
+	Op{ Instruction::lda, Mode::absolute_x, 4, Penalty::page_cross },
+	Op{ Instruction::ldx, Mode::absolute_y, 4, Penalty::page_cross },
+	invalid_op,
+
+	Op{ Instruction::cpy, Mode::immediate, 2, Penalty::none },
+	Op{ Instruction::cmp, Mode::indirect_x, 6, Penalty::none },
+	Op{ Instruction::nop, Mode::immediate, 2, Penalty::none },
+	invalid_op,
+	Op{ Instruction::cpy, Mode::zero_page, 3, Penalty::none },
+	Op{ Instruction::cmp, Mode::zero_page, 3, Penalty::none },
+	Op{ Instruction::dec, Mode::zero_page, 5, Penalty::none },
+	invalid_op,
+	Op{ Instruction::iny, Mode::implied, 2, Penalty::none },
+	Op{ Instruction::cmp, Mode::immediate, 2, Penalty::none },
+	Op{ Instruction::dex, Mode::implied, 2, Penalty::none },
+	invalid_op,
+	Op{ Instruction::cpy, Mode::absolute, 4, Penalty::none },
+	Op{ Instruction::cmp, Mode::absolute, 4, Penalty::none },
+	Op{ Instruction::dec, Mode::absolute, 6, Penalty::none },
+	invalid_op,
+
+	Op{ Instruction::bne, Mode::relative, 2, Penalty::branch },
+	Op{ Instruction::cmp, Mode::indirect_y, 5, Penalty::page_cross },
+	invalid_op,
+	invalid_op,
+	Op{ Instruction::nop, Mode::zero_page_x, 4, Penalty::none },
+	Op{ Instruction::cmp, Mode::zero_page_x, 4, Penalty::none },
+	Op{ Instruction::dec, Mode::zero_page_x, 6, Penalty::none },
+	invalid_op,
+	Op{ Instruction::cld, Mode::implied, 2, Penalty::none },
+	Op{ Instruction::cmp, Mode::absolute_y, 4, Penalty::page_cross },
+	Op{ Instruction::nop, Mode::implied, 2, Penalty::none },
+	invalid_op,
+	Op{ Instruction::nop, Mode::absolute_x, 4, Penalty::page_cross },
+	Op{ Instruction::cmp, Mode::absolute_x, 4, Penalty::page_cross },
+	Op{ Instruction::dec, Mode::absolute_x, 7, Penalty::none },
+	invalid_op,
+
+	Op{ Instruction::cpx, Mode::immediate, 2, Penalty::none },
+	Op{ Instruction::sbc, Mode::indirect_x, 6, Penalty::none },
+	Op{ Instruction::nop, Mode::immediate, 2, Penalty::none },
+	invalid_op,
+	Op{ Instruction::cpx, Mode::zero_page, 3, Penalty::none },
+	Op{ Instruction::sbc, Mode::zero_page, 3, Penalty::none },
+	Op{ Instruction::inc, Mode::zero_page, 5, Penalty::none },
+	invalid_op,
+	Op{ Instruction::inx, Mode::implied, 2, Penalty::none },
+	Op{ Instruction::sbc, Mode::immediate, 2, Penalty::none },
+	Op{ Instruction::nop, Mode::implied, 2, Penalty::none },
+	invalid_op,
+	Op{ Instruction::cpx, Mode::absolute, 4, Penalty::none },
+	Op{ Instruction::sbc, Mode::absolute, 4, Penalty::none },
+	Op{ Instruction::inc, Mode::absolute, 6, Penalty::none },
+	invalid_op,
+
+	Op{ Instruction::beq, Mode::relative, 2, Penalty::branch },
+	Op{ Instruction::sbc, Mode::indirect_y, 5, Penalty::page_cross },
+	invalid_op,
+	invalid_op,
+	Op{ Instruction::nop, Mode::zero_page_x, 4, Penalty::none },
+	Op{ Instruction::sbc, Mode::zero_page_x, 4, Penalty::none },
+	Op{ Instruction::inc, Mode::zero_page_x, 6, Penalty::none },
+	invalid_op,
+	Op{ Instruction::sed, Mode::implied, 2, Penalty::none },
+	Op{ Instruction::sbc, Mode::absolute_y, 4, Penalty::page_cross },
+	Op{ Instruction::nop, Mode::implied, 2, Penalty::none },
+	invalid_op,
+	Op{ Instruction::nop, Mode::absolute_x, 4, Penalty::page_cross },
+	Op{ Instruction::sbc, Mode::absolute_x, 4, Penalty::page_cross },
+	Op{ Instruction::inc, Mode::absolute_x, 7, Penalty::none },
+	invalid_op
+};
+
+template <Mode mode>
+uint16_t Cpu::get_addr()
+{
+	uint16_t addr;
+	page_crossed = false;
+
+	switch (mode) {
+	case Mode::implied:
+	case Mode::accumulator:
+		addr = 0;
+		break;
+	case Mode::immediate:
+		addr = program_counter + 1;
+		break;
+	case Mode::relative:
+		addr = program_counter + (int8_t)peek_arg() + 2;
+		page_crossed = pages_differ(program_counter + 2, addr);
+		break;
+	case Mode::zero_page:
+		addr = peek_arg();
+		break;
+	case Mode::zero_page_x:
+		addr = (peek_arg() + x) % page_size;
+		break;
+	case Mode::zero_page_y:
+		addr = (peek_arg() + y) % page_size;
+		break;
+	case Mode::absolute:
+		addr = peek_addr_arg();
+		break;
+	case Mode::absolute_x:
+		addr = (peek_addr_arg() + x) % memory_size;
+		page_crossed = pages_differ(peek_addr_arg(), addr);
+		break;
+	case Mode::absolute_y:
+		addr = (peek_addr_arg() + y) % memory_size;
+		page_crossed = pages_differ(peek_addr_arg(), addr);
+		break;
+	case Mode::indirect:
+		addr = read_addr_from_mem(peek_addr_arg());
+		break;
+	case Mode::indirect_x:
+		addr = as_addr(
+			memory.read((peek_arg() + x + 1) % page_size),
+			memory.read((peek_arg() + x) % page_size)
+		);
+		page_crossed = pages_differ(addr - x, addr);
+		break;
+	case Mode::indirect_y:
+		addr = (as_addr(
+			memory.read((peek_arg() + 1) % page_size),
+			memory.read(peek_arg())
+		) + y) % memory_size;
+		page_crossed = pages_differ(addr - y, addr);
+		break;
+	}
+
+	return addr;
+}
+
+template <Mode mode>
+uint8_t Cpu::load(uint16_t addr)
+{
+	return mode == Mode::accumulator ? a : memory.read(addr);
+}
+
+template <Mode mode>
+void Cpu::store(uint16_t addr, uint8_t value)
+{
+	if (mode == Mode::accumulator) {
+		a = value;
+	} else {
+		memory.write(addr, value);
+	}
+}
+
+template <Instruction instr, Mode mode>
+void Cpu::exec_instr(uint16_t addr)
+{
+	jumped = false;
+
+	switch (instr) {
+	case Instruction::nop:
+		break;
+	case Instruction::inc:
+	{
+		uint8_t m = load<mode>(addr) + 1;
+		store<mode>(addr, m);
+		zn(m);
+		break;
+	}
+	case Instruction::inx:
+		++x;
+		zn(x);
+		break;
+	case Instruction::iny:
+		++y;
+		zn(y);
+		break;
+	case Instruction::dec:
+	{
+		uint8_t m = load<mode>(addr) - 1;
+		store<mode>(addr, m);
+		zn(m);
+		break;
+	}
+	case Instruction::dex:
+		--x;
+		zn(x);
+		break;
+	case Instruction::dey:
+		--y;
+		zn(y);
+		break;
+	case Instruction::clc:
+		flags.carry = 0;
+		break;
+	case Instruction::cld:
+		flags.decimal_mode = 0;
+		break;
+	case Instruction::cli:
+		flags.interrupt_disable = 0;
+		break;
+	case Instruction::clv:
+		flags.overflow = 0;
+		break;
+	case Instruction::sec:
+		flags.carry = 1;
+		break;
+	case Instruction::sed:
+		flags.decimal_mode = 1;
+		break;
+	case Instruction::sei:
+		flags.interrupt_disable = 1;
+		break;
+	case Instruction::tax:
+		zn(x = a);
+		break;
+	case Instruction::tay:
+		zn(y = a);
+		break;
+	case Instruction::txa:
+		zn(a = x);
+		break;
+	case Instruction::tya:
+		zn(a = y);
+		break;
+	case Instruction::txs:
+		stack_ptr = x;
+		break;
+	case Instruction::tsx:
+		zn(x = stack_ptr);
+		break;
+	case Instruction::php:
+		push(get_status() | BIT(4) | BIT(5));
+		break;
+	case Instruction::pha:
+		push(a);
+		break;
+	case Instruction::plp:
+		set_status((pull() & ~BIT(4)) | BIT(5));
+		break;
+	case Instruction::pla:
+		zn(a = pull());
+		break;
+	case Instruction::bcs:
+		if (flags.carry) {
+			program_counter = addr;
+			jumped = true;
+		}
+		break;
+	case Instruction::bcc:
+		if (!flags.carry) {
+			program_counter = addr;
+			jumped = true;
+		}
+		break;
+	case Instruction::beq:
+		if (!flags.zero_result) {
+			program_counter = addr;
+			jumped = true;
+		}
+		break;
+	case Instruction::bne:
+		if (flags.zero_result) {
+			program_counter = addr;
+			jumped = true;
+		}
+		break;
+	case Instruction::bmi:
+		if (flags.negative_result & BIT(7)) {
+			program_counter = addr;
+			jumped = true;
+		}
+		break;
+	case Instruction::bpl:
+		if (!(flags.negative_result & BIT(7))) {
+			program_counter = addr;
+			jumped = true;
+		}
+		break;
+	case Instruction::bvs:
+		if (flags.overflow) {
+			program_counter = addr;
+			jumped = true;
+		}
+		break;
+	case Instruction::bvc:
+		if (!flags.overflow) {
+			program_counter = addr;
+			jumped = true;
+		}
+		break;
+	case Instruction::lda:
+		zn(a = memory.read(addr));
+		break;
+	case Instruction::ldx:
+		zn(x = memory.read(addr));
+		break;
+	case Instruction::ldy:
+		zn(y = memory.read(addr));
+		break;
+	case Instruction::sta:
+		memory.write(addr, a);
+		break;
+	case Instruction::stx:
+		memory.write(addr, x);
+		break;
+	case Instruction::sty:
+		memory.write(addr, y);
+		break;
+	case Instruction::bit:
+	{
+		auto m = memory.read(addr);
+		flags.zero_result = a & m;
+		flags.overflow = (m >> 6) & 1;
+		flags.negative_result = m;
+		break;
+	}
+	case Instruction::cmp:
+	{
+		auto m = memory.read(addr);
+		flags.carry = a >= m;
+		zn(a - m);
+		break;
+	}
+	case Instruction::cpx:
+	{
+		auto m = memory.read(addr);
+		flags.carry = x >= m;
+		zn(x - m);
+		break;
+	}
+	case Instruction::cpy:
+	{
+		auto m = memory.read(addr);
+		flags.carry = y >= m;
+		zn(y - m);
+		break;
+	}
+	case Instruction::and_:
+		zn(a &= memory.read(addr));
+		break;
+	case Instruction::ora:
+		zn(a |= memory.read(addr));
+		break;
+	case Instruction::eor:
+		zn(a ^= memory.read(addr));
+		break;
+	case Instruction::asl:
+	{
+		auto m = load<mode>(addr);
+		flags.carry = m & BIT(7) ? 1 : 0;
+		m <<= 1;
+		store<mode>(addr, m);
+		zn(m);
+		break;
+	}
+	case Instruction::lsr:
+	{
+		auto m = load<mode>(addr);
+		flags.carry = m & BIT(0) ? 1 : 0;
+		m >>= 1;
+		store<mode>(addr, m);
+		zn(m);
+		break;
+	}
+	case Instruction::rol:
+	{
+		auto old_carry = flags.carry;
+		auto m = load<mode>(addr);
+		flags.carry = m & BIT(7) ? 1 : 0;
+		m = m << 1 | old_carry;
+		store<mode>(addr, m);
+		zn(m);
+		break;
+	}
+	case Instruction::ror:
+	{
+		auto old_carry = flags.carry;
+		auto m = load<mode>(addr);
+		flags.carry = m & BIT(0) ? 1 : 0;
+		m = m >> 1 | old_carry << 7;
+		store<mode>(addr, m);
+		zn(m);
+		break;
+	}
+	case Instruction::adc:
+	{
+		auto old_a = a;
+		auto m = memory.read(addr);
+		zn(a += m + flags.carry);
+		flags.carry = old_a + m + flags.carry > 0xFF;
+		flags.overflow = !((old_a ^ m) & BIT(7)) && ((old_a ^ a) & BIT(7));
+		break;
+	}
+	case Instruction::sbc:
+	{
+		auto old_a = a;
+		auto m = memory.read(addr);
+		zn(a -= m + !flags.carry);
+		flags.carry = old_a - m - !flags.carry >= 0x00;
+		flags.overflow = (old_a ^ m) & BIT(7) && ((old_a ^ a) & BIT(7));
+		break;
+	}
+	case Instruction::jmp:
+		program_counter = addr;
+		jumped = true;
+		break;
+	case Instruction::jsr:
+		push_addr(program_counter + 2);
+		program_counter = addr;
+		jumped = true;
+		break;
+	case Instruction::rts:
+		program_counter = pull_addr() + 1;
+		jumped = true;
+		break;
+	case Instruction::brk:
+		program_counter++;
+		push_addr(program_counter);
+		push(get_status() | BIT(4) | BIT(5));
+		flags.unused_bits |= BIT(4);
+		program_counter = read_addr_from_mem(irq_vec_addr);
+		jumped = true;
+		break;
+	case Instruction::rti:
+		set_status((pull() & ~BIT(4)) | BIT(5));
+		program_counter = pull_addr();
+		jumped = true;
+		break;
+	}
+}
+
+/* One handler per opcode, with its addressing mode, cycles and penalty
+ * taken from the ops table at compile time. */
+template <uint8_t opcode>
+void Cpu::exec_op()
+{
+	constexpr Op op = ops[opcode];
+
+	if (!op.valid) {
+		GLOBAL_ERROR(std::to_string(opcode).c_str());
+	}
+
+	exec_instr<op.instr, op.mode>(get_addr<op.mode>());
+
+	unsigned penalty_sum = 0;
+
+	switch (op.penalty) {
+	case Penalty::branch:
+		if (!jumped) { break; }
+		penalty_sum++;
+	case Penalty::page_cross:
+		if (page_crossed) {
+			penalty_sum++;
+		}
+	case Penalty::none:
+		break;
+	}
+
+	if (!jumped) {
+		program_counter += get_arg_size(op.mode) + 1;
+	}
+
+	time += (op.base_cycle + penalty_sum) * cpu_cycle_ticks;
+	instructions++;
+}
+
+template <uint8_t opcode>
+void Cpu::entry(Cpu* cpu)
+{
+	cpu->exec_op<opcode>();
+}
+
+/* Whether the operand of the instruction at program_counter resolves
+ * to plain RAM/ROM, i.e. executing it cannot touch an I/O register. */
+template <uint8_t opcode>
+bool Cpu::direct_operand(Cpu* cpu)
+{
+	constexpr Op op = ops[opcode];
+	return cpu->memory.direct(cpu->get_addr<op.mode>(), writes_memory(op.instr));
+}
+
+#endif
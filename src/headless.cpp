@@ -0,0 +1,58 @@
+/* Runs a ROM with no window and no SDL: frames go to a sink that hashes
+ * them, no button is pressed.
+ *
+ * USAGE: nesemu-headless [--jit] [--frames N] rom.nes */
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+
+#include "nesemu.h"
+#include "common.h"
+
+std::ostream& logger = std::clog;
+
+int main(int argc, char** argv)
+{
+	Console console;
+
+	bool use_jit = false;
+	unsigned frames = 600;
+
+	for (int i = 1; i < argc - 1; ++i) {
+		std::string option{ argv[i] };
+		if (option == "--jit") {
+			use_jit = true;
+		} else if (option == "--frames" && i + 1 < argc - 1) {
+			frames = std::stoul(argv[++i]);
+		} else {
+			argc = 0;
+		}
+	}
+	if (argc < 2) {
+		logger << "usage: nesemu-headless [--jit] [--frames N] rom.nes\n";
+		return EXIT_FAILURE;
+	}
+
+	console.load(argv[argc - 1]);
+	console.cpu.set_jit(use_jit);
+
+	Hashing_sink sink;
+	console.video.set_sink(&sink);
+
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < frames; ++i) {
+		console.scheduler.run_frame();
+	}
+	std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+	console.video.set_sink(nullptr);
+
+	std::cout << frames << " frames in " << seconds.count() << " s ("
+		<< frames / seconds.count() << " fps), " << console.cpu.cycles() << " CPU cycles\n"
+		<< std::hex << std::setfill('0')
+		<< "last frame " << std::setw(16) << sink.last
+		<< ", all frames " << std::setw(16) << sink.combined << "\n";
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,450 @@
+#include "jit.h"
+#include "cpu.h"
+#include "memory.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+enum class Access {
+	direct, guarded, io
+};
+
+/* Where the operand of an instruction can end up, judged at translation time. */
+static Access classify(const Memory& memory, const Op& op, uint16_t operand)
+{
+	switch (op.mode) {
+	case Mode::absolute:
+		if (op.instr == Instruction::jmp || op.instr == Instruction::jsr) {
+			return Access::direct;
+		}
+		return memory.direct(operand, Cpu::writes_memory(op.instr)) ? Access::direct : Access::io;
+	case Mode::indirect:
+		return memory.direct(operand, false) ? Access::direct : Access::io;
+	case Mode::absolute_x:
+	case Mode::absolute_y:
+	case Mode::indirect_x:
+	case Mode::indirect_y:
+		return Access::guarded;
+	default:
+		// zero page, stack and immediates are always RAM/ROM
+		return Access::direct;
+	}
+}
+
+template <typename T>
+static int32_t offset_of(const Cpu& cpu, const T& field)
+{
+	return reinterpret_cast<const char*>(&field) - reinterpret_cast<const char*>(&cpu);
+}
+
+Jit::Jit(Cpu& cpu)
+	: cpu(cpu)
+	, code(nullptr)
+	, code_used(0)
+	, blocks(memory_size - base, nullptr)
+	, hits(memory_size - base, 0)
+{
+#if JIT_SUPPORTED
+	auto mem = mmap(nullptr, code_capacity, PROT_READ | PROT_WRITE,
+	                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem != MAP_FAILED) {
+		code = static_cast<uint8_t*>(mem);
+	}
+#endif
+
+	a_offset = offset_of(cpu, cpu.a);
+	x_offset = offset_of(cpu, cpu.x);
+	y_offset = offset_of(cpu, cpu.y);
+	sp_offset = offset_of(cpu, cpu.stack_ptr);
+	pc_offset = offset_of(cpu, cpu.program_counter);
+	carry_offset = offset_of(cpu, cpu.flags.carry);
+	zero_offset = offset_of(cpu, cpu.flags.zero_result);
+	negative_offset = offset_of(cpu, cpu.flags.negative_result);
+	overflow_offset = offset_of(cpu, cpu.flags.overflow);
+	interrupt_offset = offset_of(cpu, cpu.flags.interrupt_disable);
+	decimal_offset = offset_of(cpu, cpu.flags.decimal_mode);
+	operand_offset = offset_of(cpu, cpu.operand);
+	time_offset = offset_of(cpu, cpu.time);
+	instructions_offset = offset_of(cpu, cpu.instructions);
+}
+
+Jit::~Jit()
+{
+#if JIT_SUPPORTED
+	if (code) {
+		munmap(code, code_capacity);
+	}
+#endif
+}
+
+bool Jit::available()
+{
+	return JIT_SUPPORTED;
+}
+
+Jit::Block Jit::block_at(uint16_t addr)
+{
+	if (addr < base) {
+		return nullptr;
+	}
+
+	auto index = addr - base;
+	if (blocks[index]) {
+		return blocks[index];
+	}
+
+	auto& count = hits[index];
+	if (count == untranslatable || ++count < hot_threshold) {
+		return nullptr;
+	}
+
+	blocks[index] = compile(addr);
+	if (!blocks[index]) {
+		hits[index] = untranslatable;
+	}
+	return blocks[index];
+}
+
+void Jit::flush()
+{
+	std::fill(blocks.begin(), blocks.end(), nullptr);
+	std::fill(hits.begin(), hits.end(), 0);
+	code_used = 0;
+}
+
+Jit::Block Jit::compile(uint16_t start)
+{
+	if (!code) {
+		return nullptr;
+	}
+
+	buffer.clear();
+
+	emit8(0x53);                             // push rbx
+	emit8(0x48); emit8(0x89); emit8(0xFB);   // mov rbx, rdi
+
+	uint32_t addr = start;
+	unsigned dots = 0;
+	unsigned count = 0;
+	unsigned pending_cycles = 0;
+	unsigned pending_instructions = 0;
+	bool pc_stale = false;
+
+	for (;;) {
+		if (addr >= memory_size || !cpu.memory.immutable(addr)) {
+			break;
+		}
+
+		auto opcode = cpu.memory.read(addr);
+		const auto& op = Cpu::op_info(opcode);
+		auto size = Cpu::get_arg_size(op.mode) + 1;
+		if (!op.valid
+			|| addr + size > memory_size
+			|| !cpu.memory.immutable(addr + size - 1)) {
+			break;
+		}
+
+		// base cycles plus the worst case branch/page cross penalty
+		auto worst = (op.base_cycle + 2) * 3;
+		if (dots + worst > max_block_dots) {
+			break;
+		}
+
+		auto operand = cpu.decode(addr).operand;
+		auto access = classify(cpu.memory, op, operand);
+		if (access == Access::io) {
+			break;
+		}
+
+		if (op.penalty == Penalty::branch) {
+			// taken: account everything so far and leave; not taken: fall through
+			uint16_t next = addr + size;
+			uint16_t target = next + static_cast<int8_t>(operand);
+			unsigned taken_cycles = op.base_cycle + 1 + ((next & 0xFF00) != (target & 0xFF00));
+
+			auto test = branch_test(op.instr);
+			emit8(0xF6); emit8(0x83); emit32(test.offset); emit8(test.mask);   // test byte [rbx+flag], mask
+			emit8(0x0F); emit8(test.taken_if_set ? 0x84 : 0x85);               // jz/jnz not_taken
+			auto patch = buffer.size();
+			emit32(0);
+
+			emit_tick(pending_cycles + taken_cycles, pending_instructions + 1);
+			emit_set16(pc_offset, target);
+			emit8(0x5B);   // pop rbx
+			emit8(0xC3);   // ret
+
+			auto rel = static_cast<uint32_t>(buffer.size() - patch - 4);
+			for (int i = 0; i < 4; ++i) {
+				buffer[patch + i] = rel >> (8 * i);
+			}
+
+			pending_cycles += op.base_cycle;
+			pending_instructions++;
+			pc_stale = true;
+		} else if (access == Access::direct && emit_native(op, operand)) {
+			pending_cycles += op.base_cycle;
+			pending_instructions++;
+			pc_stale = true;
+		} else {
+			if (pending_instructions) {
+				emit_tick(pending_cycles, pending_instructions);
+				pending_cycles = pending_instructions = 0;
+			}
+
+			emit_set16(pc_offset, addr);
+			emit_set16(operand_offset, operand);
+
+			if (access == Access::guarded) {
+				// leave the block, the interpreter will do the I/O access
+				emit_call(reinterpret_cast<const void*>(Cpu::op_guards[opcode]));
+				emit8(0x84); emit8(0xC0);   // test al, al
+				emit8(0x75); emit8(0x02);   // jnz +2
+				emit8(0x5B);                // pop rbx
+				emit8(0xC3);                // ret
+			}
+
+			emit_call(reinterpret_cast<const void*>(Cpu::op_entries[opcode]));
+			pc_stale = false;
+		}
+
+		dots += worst;
+		count++;
+		addr += size;
+
+		if (op.mode == Mode::absolute
+			&& (op.instr == Instruction::jmp || op.instr == Instruction::jsr)) {
+			// the target is known, follow it
+			addr = operand;
+		} else if (Cpu::ends_block(op.instr) && op.penalty != Penalty::branch) {
+			break;
+		}
+	}
+
+	if (count == 0) {
+		return nullptr;
+	}
+
+	if (pending_instructions) {
+		emit_tick(pending_cycles, pending_instructions);
+	}
+	if (pc_stale) {
+		emit_set16(pc_offset, addr);
+	}
+
+	emit8(0x5B);   // pop rbx
+	emit8(0xC3);   // ret
+
+	return install();
+}
+
+Jit::Block Jit::install()
+{
+	if (code_used + buffer.size() > code_capacity) {
+		flush();
+	}
+
+	auto dest = code + code_used;
+#if JIT_SUPPORTED
+	mprotect(code, code_capacity, PROT_READ | PROT_WRITE);
+	std::memcpy(dest, buffer.data(), buffer.size());
+	mprotect(code, code_capacity, PROT_READ | PROT_EXEC);
+#endif
+	code_used += buffer.size();
+
+	return reinterpret_cast<Block>(dest);
+}
+
+/* Native code for register, flag and compare instructions,
+ * and for loads/stores whose operand is plain RAM/ROM. */
+bool Jit::emit_native(const Op& op, uint16_t operand)
+{
+	auto load = [this](int32_t offset) {
+		emit8(0x0F); emit8(0xB6); emit8(0x83); emit32(offset);   // movzx eax, byte [rbx+offset]
+	};
+	auto store = [this](int32_t offset) {
+		emit8(0x88); emit8(0x83); emit32(offset);                // mov [rbx+offset], al
+	};
+	auto set_flag = [this](int32_t offset, uint8_t value) {
+		emit8(0xC6); emit8(0x83); emit32(offset); emit8(value);  // mov byte [rbx+offset], value
+	};
+	auto transfer = [&](int32_t from, int32_t to) {
+		load(from);
+		store(to);
+		emit_zn();
+	};
+	auto increment = [&](int32_t reg, bool up) {
+		load(reg);
+		emit8(0xFF); emit8(up ? 0xC0 : 0xC8);                    // inc/dec eax
+		store(reg);
+		emit_zn();
+	};
+	auto immediate = [&](int32_t reg) {
+		emit8(0xB8); emit32(operand & 0xFF);                     // mov eax, imm
+		store(reg);
+		emit_zn();
+	};
+	auto logic = [&](uint8_t opcode) {
+		load(a_offset);
+		emit8(opcode); emit32(operand & 0xFF);                   // and/or/xor eax, imm
+		store(a_offset);
+		emit_zn();
+	};
+	auto compare = [&](int32_t reg) {
+		load(reg);
+		emit8(0x2D); emit32(operand & 0xFF);                     // sub eax, imm
+		emit_zn();
+		emit8(0xA9); emit32(0x100);                              // test eax, 0x100 (borrow)
+		emit8(0x0F); emit8(0x94); emit8(0xC1);                   // sete cl
+		emit8(0x88); emit8(0x8B); emit32(carry_offset);          // mov [rbx+carry], cl
+	};
+	// RAM/ROM operands are read and written through their host address
+	auto host = [&](bool write) {
+		return op.mode == Mode::zero_page || op.mode == Mode::absolute
+			? cpu.memory.host(operand, write) : nullptr;
+	};
+	auto load_host = [&](int32_t reg) {
+		auto ptr = host(false);
+		if (!ptr) {
+			return false;
+		}
+		emit8(0x48); emit8(0xB8); emit64(reinterpret_cast<uint64_t>(ptr));   // mov rax, ptr
+		emit8(0x0F); emit8(0xB6); emit8(0x00);                              // movzx eax, byte [rax]
+		store(reg);
+		emit_zn();
+		return true;
+	};
+	auto store_host = [&](int32_t reg) {
+		auto ptr = host(true);
+		if (!ptr) {
+			return false;
+		}
+		load(reg);
+		emit8(0x48); emit8(0xB9); emit64(reinterpret_cast<uint64_t>(ptr));   // mov rcx, ptr
+		emit8(0x88); emit8(0x01);                                           // mov [rcx], al
+		return true;
+	};
+
+	if (op.mode == Mode::immediate) {
+		switch (op.instr) {
+		case Instruction::lda: immediate(a_offset); return true;
+		case Instruction::ldx: immediate(x_offset); return true;
+		case Instruction::ldy: immediate(y_offset); return true;
+		case Instruction::and_: logic(0x25); return true;
+		case Instruction::ora: logic(0x0D); return true;
+		case Instruction::eor: logic(0x35); return true;
+		case Instruction::cmp: compare(a_offset); return true;
+		case Instruction::cpx: compare(x_offset); return true;
+		case Instruction::cpy: compare(y_offset); return true;
+		default: return false;
+		}
+	}
+
+	switch (op.instr) {
+	case Instruction::lda: return load_host(a_offset);
+	case Instruction::ldx: return load_host(x_offset);
+	case Instruction::ldy: return load_host(y_offset);
+	case Instruction::sta: return store_host(a_offset);
+	case Instruction::stx: return store_host(x_offset);
+	case Instruction::sty: return store_host(y_offset);
+	default: break;
+	}
+
+	if (op.mode != Mode::implied) {
+		return false;
+	}
+
+	switch (op.instr) {
+	case Instruction::nop: return true;
+	case Instruction::clc: set_flag(carry_offset, 0); return true;
+	case Instruction::sec: set_flag(carry_offset, 1); return true;
+	case Instruction::cli: set_flag(interrupt_offset, 0); return true;
+	case Instruction::sei: set_flag(interrupt_offset, 1); return true;
+	case Instruction::cld: set_flag(decimal_offset, 0); return true;
+	case Instruction::sed: set_flag(decimal_offset, 1); return true;
+	case Instruction::clv: set_flag(overflow_offset, 0); return true;
+	case Instruction::tax: transfer(a_offset, x_offset); return true;
+	case Instruction::tay: transfer(a_offset, y_offset); return true;
+	case Instruction::txa: transfer(x_offset, a_offset); return true;
+	case Instruction::tya: transfer(y_offset, a_offset); return true;
+	case Instruction::tsx: transfer(sp_offset, x_offset); return true;
+	case Instruction::txs: load(x_offset); store(sp_offset); return true;
+	case Instruction::inx: increment(x_offset, true); return true;
+	case Instruction::iny: increment(y_offset, true); return true;
+	case Instruction::dex: increment(x_offset, false); return true;
+	case Instruction::dey: increment(y_offset, false); return true;
+	default: return false;
+	}
+}
+
+/* Set zero and negative from al, like Cpu::zn. */
+void Jit::emit_zn()
+{
+	emit8(0x88); emit8(0x83); emit32(zero_offset);       // mov [rbx+zero], al
+	emit8(0x88); emit8(0x83); emit32(negative_offset);   // mov [rbx+negative], al
+}
+
+/* How a conditional branch tests its flag: taken if the masked byte is
+ * non-zero (or zero, for taken_if_set == false). */
+Jit::Branch_test Jit::branch_test(Instruction instr) const
+{
+	switch (instr) {
+	case Instruction::bcs: return { carry_offset, 0x01, true };
+	case Instruction::bcc: return { carry_offset, 0x01, false };
+	case Instruction::beq: return { zero_offset, 0xFF, false };
+	case Instruction::bne: return { zero_offset, 0xFF, true };
+	case Instruction::bvs: return { overflow_offset, 0x01, true };
+	case Instruction::bvc: return { overflow_offset, 0x01, false };
+	case Instruction::bmi: return { negative_offset, 0x80, true };
+	default:               return { negative_offset, 0x80, false };   // bpl
+	}
+}
+
+void Jit::emit_tick(unsigned cycles, unsigned instructions)
+{
+	emit8(0x48); emit8(0x81); emit8(0x83); emit32(time_offset);           // add qword [rbx+time], ticks
+	emit32(cycles * cpu_cycle_ticks);
+	emit8(0x48); emit8(0x81); emit8(0x83); emit32(instructions_offset);   // add qword [rbx+instructions], count
+	emit32(instructions);
+}
+
+void Jit::emit_call(const void* func)
+{
+	emit8(0x48); emit8(0x89); emit8(0xDF);                          // mov rdi, rbx
+	emit8(0x48); emit8(0xB8); emit64(reinterpret_cast<uint64_t>(func));   // mov rax, func
+	emit8(0xFF); emit8(0xD0);                                       // call rax
+}
+
+void Jit::emit_set16(int32_t offset, uint16_t value)
+{
+	emit8(0x66); emit8(0xC7); emit8(0x83); emit32(offset); emit16(value);   // mov word [rbx+offset], value
+}
+
+void Jit::emit8(uint8_t value)
+{
+	buffer.push_back(value);
+}
+
+void Jit::emit16(uint16_t value)
+{
+	emit8(value);
+	emit8(value >> 8);
+}
+
+void Jit::emit32(uint32_t value)
+{
+	emit16(value);
+	emit16(value >> 16);
+}
+
+void Jit::emit64(uint64_t value)
+{
+	emit32(value);
+	emit32(value >> 32);
+}
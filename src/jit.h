@@ -0,0 +1,87 @@
+#ifndef NESEMU_JIT_H
+#define NESEMU_JIT_H
+
+#include "common.h"
+#include "cpu.h"
+
+#include <vector>
+#include <cstdint>
+
+/* Dynamic recompiler for hot straight-line runs of ROM code (x86-64 only).
+ *
+ * A block runs from its entry up to the next control flow instruction that
+ * cannot be followed statically; conditional branches exit only when taken.
+ * Register, flag, compare and plain RAM/ROM load/store instructions are
+ * emitted as native code, everything else as a direct call into the
+ * interpreter's handler for that opcode, so the interpreter stays the
+ * reference for semantics.
+ *
+ * Blocks never touch I/O registers: an instruction whose operand is known to
+ * be I/O ends the block before it, and indexed/indirect operands are checked
+ * at run time, leaving the block so the interpreter executes the access with
+ * the PPU caught up as usual. Cycles are exact per block; interrupts are
+ * polled between blocks, and no block is entered unless it ends before the
+ * next scheduler event, so they arrive when they do in the interpreter. */
+class Jit {
+public:
+	using Block = void (*)(Cpu* cpu);
+
+	explicit Jit(Cpu& cpu);
+	~Jit();
+
+	Jit(const Jit&) = delete;
+	Jit& operator=(const Jit&) = delete;
+
+	static bool available();
+
+	// worst case PPU dots per block, see Cpu::step
+	static const unsigned max_block_dots = 300;
+
+	// translated block starting at addr, nullptr if it is not (yet) hot
+	Block block_at(uint16_t addr);
+	void flush();
+
+private:
+	static const uint16_t base = 0x8000;
+	static const uint8_t hot_threshold = 16;
+	static const uint8_t untranslatable = 0xFF;
+	static const size_t code_capacity = 1 << 20;
+
+	Cpu& cpu;
+
+	uint8_t* code;
+	size_t code_used;
+	std::vector<Block> blocks;
+	std::vector<uint8_t> hits;
+	std::vector<uint8_t> buffer;
+
+	// byte offsets of the Cpu fields touched by generated code
+	int32_t a_offset, x_offset, y_offset, sp_offset;
+	int32_t pc_offset, operand_offset;
+	int32_t carry_offset, zero_offset, negative_offset;
+	int32_t overflow_offset, interrupt_offset, decimal_offset;
+	int32_t time_offset, instructions_offset;
+
+	struct Branch_test {
+		int32_t offset;
+		uint8_t mask;
+		bool taken_if_set;
+	};
+
+	Block compile(uint16_t addr);
+	Block install();
+
+	bool emit_native(const Op& op, uint16_t operand);
+	void emit_tick(unsigned cycles, unsigned instructions);
+	void emit_call(const void* func);
+	void emit_set16(int32_t offset, uint16_t value);
+	void emit_zn();
+	Branch_test branch_test(Instruction instr) const;
+
+	void emit8(uint8_t value);
+	void emit16(uint16_t value);
+	void emit32(uint32_t value);
+	void emit64(uint64_t value);
+};
+
+#endif
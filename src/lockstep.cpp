@@ -0,0 +1,666 @@
+#include "lockstep.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+const size_t Lane_registers::width;
+const size_t Lockstep::min_group;
+
+void Lane_registers::resize(size_t count)
+{
+	auto padded = (count + width - 1) / width * width;
+	for (auto field : { &a, &x, &y, &stack_ptr, &carry, &zero_result, &negative_result,
+		&overflow, &interrupt_disable, &decimal_mode, &m }) {
+		field->resize(padded);
+	}
+}
+
+/* The lane versions are written once with GCC vector types and compiled
+ * twice, the AVX2 build doing 32 lanes per instruction. Flags are kept the
+ * way Cpu::Flags keeps them: carry and overflow 0 or 1, Z and N as the value
+ * they come from. Comparisons give all ones per lane, hence the & 1. */
+
+using Bytes = uint8_t __attribute__((vector_size(Lane_registers::width)));
+
+// lanes is an out parameter: returning a 32 byte vector by value changes
+// the ABI between the generic and the AVX2 build
+static inline __attribute__((always_inline)) void load_lanes(const std::vector<uint8_t>& field, size_t i, Bytes& lanes)
+{
+	std::memcpy(&lanes, field.data() + i, sizeof lanes);
+}
+
+static inline __attribute__((always_inline)) void store_lanes(std::vector<uint8_t>& field, size_t i, const Bytes& lanes)
+{
+	std::memcpy(field.data() + i, &lanes, sizeof lanes);
+}
+
+static inline __attribute__((always_inline))
+void exec_lanes_body(Instruction instr, bool accumulator, Lane_registers& lanes, size_t count)
+{
+	for (size_t i = 0; i < count; i += Lane_registers::width) {
+		Bytes a, x, y, sp, c, z, n, v, id, d, m;
+		load_lanes(lanes.a, i, a);
+		load_lanes(lanes.x, i, x);
+		load_lanes(lanes.y, i, y);
+		load_lanes(lanes.stack_ptr, i, sp);
+		load_lanes(lanes.carry, i, c);
+		load_lanes(lanes.zero_result, i, z);
+		load_lanes(lanes.negative_result, i, n);
+		load_lanes(lanes.overflow, i, v);
+		load_lanes(lanes.interrupt_disable, i, id);
+		load_lanes(lanes.decimal_mode, i, d);
+		load_lanes(lanes.m, i, m);
+		// what shifts and rotates work on
+		Bytes& target = accumulator ? a : m;
+
+		switch (instr) {
+		case Instruction::inc: z = n = m += 1; break;
+		case Instruction::dec: z = n = m -= 1; break;
+		case Instruction::inx: z = n = x += 1; break;
+		case Instruction::iny: z = n = y += 1; break;
+		case Instruction::dex: z = n = x -= 1; break;
+		case Instruction::dey: z = n = y -= 1; break;
+		case Instruction::clc: c = c & 0; break;
+		case Instruction::cld: d = d & 0; break;
+		case Instruction::cli: id = id & 0; break;
+		case Instruction::clv: v = v & 0; break;
+		case Instruction::sec: c = (c & 0) | 1; break;
+		case Instruction::sed: d = (d & 0) | 1; break;
+		case Instruction::sei: id = (id & 0) | 1; break;
+		case Instruction::tax: z = n = x = a; break;
+		case Instruction::tay: z = n = y = a; break;
+		case Instruction::txa: z = n = a = x; break;
+		case Instruction::tya: z = n = a = y; break;
+		case Instruction::txs: sp = x; break;
+		case Instruction::tsx: z = n = x = sp; break;
+		case Instruction::lda: z = n = a = m; break;
+		case Instruction::ldx: z = n = x = m; break;
+		case Instruction::ldy: z = n = y = m; break;
+		case Instruction::bit:
+			z = a & m;
+			v = (m >> 6) & 1;
+			n = m;
+			break;
+		case Instruction::cmp: c = (Bytes)(a >= m) & 1; z = n = a - m; break;
+		case Instruction::cpx: c = (Bytes)(x >= m) & 1; z = n = x - m; break;
+		case Instruction::cpy: c = (Bytes)(y >= m) & 1; z = n = y - m; break;
+		case Instruction::and_: z = n = a &= m; break;
+		case Instruction::ora: z = n = a |= m; break;
+		case Instruction::eor: z = n = a ^= m; break;
+		case Instruction::asl:
+			c = target >> 7;
+			z = n = target <<= 1;
+			break;
+		case Instruction::lsr:
+			c = target & 1;
+			z = n = target >>= 1;
+			break;
+		case Instruction::rol:
+		{
+			Bytes old_carry = c;
+			c = target >> 7;
+			z = n = target = (Bytes)(target << 1) | old_carry;
+			break;
+		}
+		case Instruction::ror:
+		{
+			Bytes old_carry = c;
+			c = target & 1;
+			z = n = target = (Bytes)(target >> 1) | (Bytes)(old_carry << 7);
+			break;
+		}
+		case Instruction::adc:
+		{
+			// carry out of either of the two additions
+			Bytes partial = a + m;
+			Bytes sum = partial + c;
+			c = (Bytes)((partial < a) | (sum < partial)) & 1;
+			v = (Bytes)(~(a ^ m) & (a ^ sum)) >> 7;
+			z = n = a = sum;
+			break;
+		}
+		case Instruction::sbc:
+		{
+			// borrow out of either of the two subtractions
+			Bytes partial = a - m;
+			Bytes difference = partial - (1 - c);
+			c = (Bytes)((a >= m) & (partial >= (Bytes)(1 - c))) & 1;
+			v = (Bytes)((a ^ m) & (a ^ difference)) >> 7;
+			z = n = a = difference;
+			break;
+		}
+		default:
+			break;
+		}
+
+		store_lanes(lanes.a, i, a);
+		store_lanes(lanes.x, i, x);
+		store_lanes(lanes.y, i, y);
+		store_lanes(lanes.stack_ptr, i, sp);
+		store_lanes(lanes.carry, i, c);
+		store_lanes(lanes.zero_result, i, z);
+		store_lanes(lanes.negative_result, i, n);
+		store_lanes(lanes.overflow, i, v);
+		store_lanes(lanes.interrupt_disable, i, id);
+		store_lanes(lanes.decimal_mode, i, d);
+		store_lanes(lanes.m, i, m);
+	}
+}
+
+void exec_lanes_generic(Instruction instr, bool accumulator, Lane_registers& lanes, size_t count)
+{
+	exec_lanes_body(instr, accumulator, lanes, count);
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2")))
+void exec_lanes_avx2(Instruction instr, bool accumulator, Lane_registers& lanes, size_t count)
+{
+	exec_lanes_body(instr, accumulator, lanes, count);
+}
+
+static Exec_lanes pick_exec_lanes()
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return exec_lanes_avx2;
+	}
+	return exec_lanes_generic;
+}
+
+const Exec_lanes exec_lanes = pick_exec_lanes();
+
+#else
+
+void exec_lanes_avx2(Instruction instr, bool accumulator, Lane_registers& lanes, size_t count)
+{
+	exec_lanes_generic(instr, accumulator, lanes, count);
+}
+
+const Exec_lanes exec_lanes = exec_lanes_generic;
+
+#endif
+
+// reads its operand, i.e. needs m before exec_lanes
+static bool reads_operand(Instruction instr)
+{
+	switch (instr) {
+	case Instruction::lda: case Instruction::ldx: case Instruction::ldy:
+	case Instruction::bit: case Instruction::cmp: case Instruction::cpx:
+	case Instruction::cpy: case Instruction::and_: case Instruction::ora:
+	case Instruction::eor: case Instruction::adc: case Instruction::sbc:
+	case Instruction::inc: case Instruction::dec:
+	case Instruction::asl: case Instruction::lsr:
+	case Instruction::rol: case Instruction::ror:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Instructions a group can run together: the same cycle count in every
+ * console, and operands that are immediate, on the stack, or at an address
+ * that does not depend on anything but X or Y within the zero page. Loads
+ * and stores may go to I/O, which ends the group. Branches and RTS are only
+ * taken together if every console goes the same way, see
+ * Lockstep::run_instruction. */
+static bool groupable(Memory& memory, const Op& op, uint16_t operand)
+{
+	if (!op.valid) {
+		return false;
+	}
+
+	switch (op.instr) {
+	case Instruction::brk: case Instruction::rti:
+	case Instruction::php: case Instruction::plp:
+		return false;
+	case Instruction::jmp:
+		return op.mode == Mode::absolute;
+	case Instruction::jsr: case Instruction::rts:
+	case Instruction::pha: case Instruction::pla:
+		return true;
+	default:
+		break;
+	}
+
+	switch (op.mode) {
+	case Mode::implied:
+	case Mode::accumulator:
+	case Mode::immediate:
+	case Mode::relative:
+	case Mode::zero_page:
+	case Mode::zero_page_x:
+	case Mode::zero_page_y:
+		return true;
+	case Mode::absolute:
+		// a read-modify-write to I/O also writes the old value
+		return memory.direct(operand, Cpu::writes_memory(op.instr))
+			|| !Cpu::writes_memory(op.instr) || op.instr == Instruction::sta
+			|| op.instr == Instruction::stx || op.instr == Instruction::sty;
+	default:
+		return false;
+	}
+}
+
+// whether instr at pc branches, given the flags of one lane
+static bool branch_taken(Instruction instr, const Lane_registers& lanes, size_t i)
+{
+	switch (instr) {
+	case Instruction::bcs: return lanes.carry[i];
+	case Instruction::bcc: return !lanes.carry[i];
+	case Instruction::beq: return !lanes.zero_result[i];
+	case Instruction::bne: return lanes.zero_result[i];
+	case Instruction::bmi: return lanes.negative_result[i] & BIT(7);
+	case Instruction::bpl: return !(lanes.negative_result[i] & BIT(7));
+	case Instruction::bvs: return lanes.overflow[i];
+	case Instruction::bvc: return !lanes.overflow[i];
+	default: return false;
+	}
+}
+
+Lockstep::Lockstep(const std::string& rom_path, size_t count)
+{
+	for (size_t i = 0; i < count; ++i) {
+		consoles.emplace_back(new Console);
+		consoles.back()->load(rom_path);
+		// bank switching could show consoles different code at one address
+		if (consoles.back()->cart->mapper_number != 0) {
+			GLOBAL_ERROR("only mapper 0 ROMs can be run in lockstep");
+		}
+	}
+	group.reserve(count);
+	lanes.resize(count);
+	group_ram.reserve(count);
+	group_time.reserve(count);
+}
+
+size_t Lockstep::size() const
+{
+	return consoles.size();
+}
+
+Console& Lockstep::console(size_t lane)
+{
+	return *consoles.at(lane);
+}
+
+/* Each console goes through the batches of Scheduler::run_frame, only
+ * interleaved with the others: a round gives every console whose CPU is
+ * due some instructions, a console whose CPU is past the next event gets
+ * its PPU caught up and its next batch begun. */
+void Lockstep::run_frame()
+{
+	std::vector<unsigned> frames;
+	std::vector<size_t> running;
+	for (size_t lane = 0; lane < size(); ++lane) {
+		frames.push_back(consoles[lane]->ppu.frame_count());
+		running.push_back(lane);
+		consoles[lane]->scheduler.begin_batch();
+	}
+
+	// (program counter, lane) of the consoles that may run in a group
+	std::vector<std::pair<uint16_t, size_t>> candidates;
+
+	while (!running.empty()) {
+		candidates.clear();
+		for (auto lane : running) {
+			if (!consoles[lane]->scheduler.cpu_due()) {
+				continue;
+			}
+			if (can_group(lane)) {
+				candidates.emplace_back(consoles[lane]->cpu.program_counter, lane);
+			} else {
+				step(lane);
+			}
+		}
+
+		std::sort(candidates.begin(), candidates.end());
+		for (size_t begin = 0, end; begin < candidates.size(); begin = end) {
+			auto pc = candidates[begin].first;
+			for (end = begin; end < candidates.size() && candidates[end].first == pc; ++end) {
+			}
+
+			if (end - begin < min_group) {
+				for (auto i = begin; i < end; ++i) {
+					step(candidates[i].second);
+				}
+				continue;
+			}
+			group.clear();
+			for (auto i = begin; i < end; ++i) {
+				group.push_back(candidates[i].second);
+			}
+			run_group(pc);
+		}
+
+		// end the batches the CPU is done with, begin the next ones
+		auto done = std::remove_if(running.begin(), running.end(), [&](size_t lane) {
+			auto& console = *consoles[lane];
+			if (console.scheduler.cpu_due()) {
+				return false;
+			}
+			console.scheduler.end_batch();
+			if (console.ppu.frame_count() != frames[lane]) {
+				return true;
+			}
+			console.scheduler.begin_batch();
+			return false;
+		});
+		running.erase(done, running.end());
+	}
+}
+
+void Lockstep::step(size_t lane)
+{
+	auto& cpu = consoles[lane]->cpu;
+	auto retired = cpu.instructions;
+	cpu.step();
+	stats.scalar_instructions += cpu.instructions - retired;
+}
+
+// whether Cpu::step would do nothing but interpret the instruction at PC
+bool Lockstep::can_group(size_t lane) const
+{
+	auto& cpu = consoles[lane]->cpu;
+	auto& memory = consoles[lane]->memory;
+	auto pc = cpu.program_counter;
+
+	if (cpu.interrupt != Cpu::Interrupt::none || cpu.cycle_stall
+		|| (cpu.idle.valid && BETWEEN(pc, cpu.idle.head, cpu.idle.end + 1))
+		|| !memory.immutable(pc)) {
+		return false;
+	}
+
+	const auto& op = Cpu::op_info(memory.read(pc));
+	auto operand = Cpu::get_arg_size(op.mode) == 2 ? memory.read_addr(pc + 1) : memory.read(pc + 1);
+	return groupable(memory, op, operand);
+}
+
+/* Runs the group from pc up to the first instruction it cannot run
+ * together, or until one of its consoles reaches its next event. */
+void Lockstep::run_group(uint16_t pc)
+{
+	gather();
+
+	// every instruction costs the same in all consoles of the group
+	auto budget = std::numeric_limits<Master_time>::max();
+	for (auto lane : group) {
+		auto& console = *consoles[lane];
+		budget = std::min(budget, console.scheduler.next() - console.cpu.time);
+	}
+
+	auto& leader = *consoles[group[0]];
+	Master_time elapsed = 0;
+	uint64_t instructions = 0;
+	bool last = false;
+	while (!last && elapsed <= budget && run_instruction(leader, pc, elapsed, last)) {
+		++instructions;
+	}
+
+	scatter(pc, elapsed, instructions);
+	++stats.groups;
+	stats.group_lanes += group.size();
+	stats.vector_instructions += instructions * group.size();
+
+	// split up right away, e.g. on a branch: go on one by one
+	if (!instructions) {
+		for (auto lane : group) {
+			step(lane);
+		}
+	}
+}
+
+/* Runs the instruction at pc in every console of the group, moving pc
+ * past it and elapsed on by its cycles, or returns false if the group
+ * cannot run it together. last is set after an I/O access: it may have
+ * changed the scheduler's events or raised an interrupt. */
+bool Lockstep::run_instruction(Console& leader, uint16_t& pc, Master_time& elapsed, bool& last)
+{
+	for (auto& loop : idle_loops) {
+		if (BETWEEN(pc, loop.first, loop.second + 1)) {
+			return false;
+		}
+	}
+	if (!leader.memory.immutable(pc)) {
+		return false;
+	}
+
+	const auto& op = Cpu::op_info(leader.memory.read(pc));
+	auto size = Cpu::get_arg_size(op.mode) + 1;
+	uint16_t operand = size == 3 ? leader.memory.read_addr(pc + 1) : leader.memory.read(pc + 1);
+	if (!groupable(leader.memory, op, operand)) {
+		return false;
+	}
+	unsigned cycles = op.base_cycle;
+
+	auto count = group.size();
+	uint16_t next = pc + size;
+	// Cpu::step looks for an idle loop after jumping back a little
+	auto jump_to = [&](uint16_t target) {
+		if (target <= pc && (unsigned)(pc - target) < Cpu::max_idle_loop_size) {
+			return false;
+		}
+		next = target;
+		return true;
+	};
+	auto stack = [&](size_t i) {
+		return group_ram[i] + Cpu::stack_page + lanes.stack_ptr[i];
+	};
+
+	switch (op.instr) {
+	case Instruction::bcs: case Instruction::bcc:
+	case Instruction::beq: case Instruction::bne:
+	case Instruction::bmi: case Instruction::bpl:
+	case Instruction::bvs: case Instruction::bvc:
+	{
+		bool taken = branch_taken(op.instr, lanes, 0);
+		for (size_t i = 1; i < count; ++i) {
+			if (branch_taken(op.instr, lanes, i) != taken) {
+				return false;
+			}
+		}
+		if (taken) {
+			uint16_t target = next + (int8_t)operand;
+			cycles += 1 + ((target & 0xFF00) != (next & 0xFF00));
+			if (!jump_to(target)) {
+				return false;
+			}
+		}
+		pc = next;
+		elapsed += cycles * cpu_cycle_ticks;
+		return true;
+	}
+	case Instruction::jmp:
+		if (!jump_to(operand)) {
+			return false;
+		}
+		pc = next;
+		elapsed += cycles * cpu_cycle_ticks;
+		return true;
+	case Instruction::jsr:
+		if (!jump_to(operand)) {
+			return false;
+		}
+		for (size_t i = 0; i < count; ++i) {
+			*stack(i) = (pc + 2) >> 8;
+			lanes.stack_ptr[i]--;
+			*stack(i) = (pc + 2) & 0xFF;
+			lanes.stack_ptr[i]--;
+		}
+		pc = next;
+		elapsed += cycles * cpu_cycle_ticks;
+		return true;
+	case Instruction::rts:
+	{
+		// where each console returns to, nothing is pulled unless all agree
+		auto return_to = [&](size_t i) {
+			auto& ram = group_ram[i];
+			uint8_t sp = lanes.stack_ptr[i];
+			return (uint16_t)((ram[Cpu::stack_page + (uint8_t)(sp + 2)] << 8
+				| ram[Cpu::stack_page + (uint8_t)(sp + 1)]) + 1);
+		};
+		auto target = return_to(0);
+		for (size_t i = 1; i < count; ++i) {
+			if (return_to(i) != target) {
+				return false;
+			}
+		}
+		if (!jump_to(target)) {
+			return false;
+		}
+		for (size_t i = 0; i < count; ++i) {
+			lanes.stack_ptr[i] += 2;
+		}
+		pc = next;
+		elapsed += cycles * cpu_cycle_ticks;
+		return true;
+	}
+	case Instruction::pha:
+		for (size_t i = 0; i < count; ++i) {
+			*stack(i) = lanes.a[i];
+			lanes.stack_ptr[i]--;
+		}
+		pc = next;
+		elapsed += cycles * cpu_cycle_ticks;
+		return true;
+	case Instruction::pla:
+		for (size_t i = 0; i < count; ++i) {
+			lanes.stack_ptr[i]++;
+			lanes.a[i] = lanes.zero_result[i] = lanes.negative_result[i] = *stack(i);
+		}
+		pc = next;
+		elapsed += cycles * cpu_cycle_ticks;
+		return true;
+	default:
+		break;
+	}
+	pc = next;
+
+	bool io = op.mode == Mode::absolute
+		&& !leader.memory.direct(operand, Cpu::writes_memory(op.instr));
+	if (io) {
+		// the access sees each console at the time it starts at, like in Cpu::step
+		for (size_t i = 0; i < count; ++i) {
+			consoles[group[i]]->cpu.time = group_time[i] + elapsed;
+		}
+		last = true;
+	}
+	elapsed += cycles * cpu_cycle_ticks;
+
+	// each console's operand: in its internal RAM, the common ROM or I/O
+	auto address = [&](size_t i) -> uint8_t* {
+		switch (op.mode) {
+		case Mode::zero_page:
+			return group_ram[i] + operand;
+		case Mode::zero_page_x:
+			return group_ram[i] + (uint8_t)(operand + lanes.x[i]);
+		case Mode::zero_page_y:
+			return group_ram[i] + (uint8_t)(operand + lanes.y[i]);
+		default:
+			return consoles[group[i]]->memory.host(operand, Cpu::writes_memory(op.instr));
+		}
+	};
+	auto read = [&](size_t i) {
+		return io ? consoles[group[i]]->memory.read(operand) : *address(i);
+	};
+	auto write = [&](size_t i, uint8_t value) {
+		if (io) {
+			consoles[group[i]]->memory.write(operand, value);
+		} else {
+			*address(i) = value;
+		}
+	};
+	bool in_memory = op.mode != Mode::implied && op.mode != Mode::accumulator
+		&& op.mode != Mode::immediate;
+
+	switch (op.instr) {
+	case Instruction::sta:
+		for (size_t i = 0; i < count; ++i) {
+			write(i, lanes.a[i]);
+		}
+		return true;
+	case Instruction::stx:
+		for (size_t i = 0; i < count; ++i) {
+			write(i, lanes.x[i]);
+		}
+		return true;
+	case Instruction::sty:
+		for (size_t i = 0; i < count; ++i) {
+			write(i, lanes.y[i]);
+		}
+		return true;
+	default:
+		break;
+	}
+
+	if (op.mode == Mode::immediate) {
+		std::fill(lanes.m.begin(), lanes.m.begin() + count, (uint8_t)operand);
+	} else if (in_memory && reads_operand(op.instr)) {
+		for (size_t i = 0; i < count; ++i) {
+			lanes.m[i] = read(i);
+		}
+	}
+
+	exec_lanes(op.instr, op.mode == Mode::accumulator, lanes, count);
+
+	if (in_memory && Cpu::writes_memory(op.instr)) {
+		for (size_t i = 0; i < count; ++i) {
+			write(i, lanes.m[i]);
+		}
+	}
+	return true;
+}
+
+void Lockstep::gather()
+{
+	auto count = group.size();
+	group_ram.resize(count);
+	group_time.resize(count);
+	idle_loops.clear();
+
+	for (size_t i = 0; i < count; ++i) {
+		auto& console = *consoles[group[i]];
+		auto& cpu = console.cpu;
+		lanes.a[i] = cpu.a;
+		lanes.x[i] = cpu.x;
+		lanes.y[i] = cpu.y;
+		lanes.stack_ptr[i] = cpu.stack_ptr;
+		lanes.carry[i] = cpu.flags.carry;
+		lanes.zero_result[i] = cpu.flags.zero_result;
+		lanes.negative_result[i] = cpu.flags.negative_result;
+		lanes.overflow[i] = cpu.flags.overflow;
+		lanes.interrupt_disable[i] = cpu.flags.interrupt_disable;
+		lanes.decimal_mode[i] = cpu.flags.decimal_mode;
+		group_ram[i] = console.memory.host(0, true);
+		group_time[i] = cpu.time;
+
+		if (cpu.idle.valid) {
+			auto loop = std::make_pair(cpu.idle.head, cpu.idle.end);
+			if (std::find(idle_loops.begin(), idle_loops.end(), loop) == idle_loops.end()) {
+				idle_loops.push_back(loop);
+			}
+		}
+	}
+}
+
+void Lockstep::scatter(uint16_t pc, Master_time elapsed, uint64_t instructions)
+{
+	for (size_t i = 0; i < group.size(); ++i) {
+		auto& cpu = consoles[group[i]]->cpu;
+		cpu.a = lanes.a[i];
+		cpu.x = lanes.x[i];
+		cpu.y = lanes.y[i];
+		cpu.stack_ptr = lanes.stack_ptr[i];
+		cpu.flags.carry = lanes.carry[i];
+		cpu.flags.zero_result = lanes.zero_result[i];
+		cpu.flags.negative_result = lanes.negative_result[i];
+		cpu.flags.overflow = lanes.overflow[i];
+		cpu.flags.interrupt_disable = lanes.interrupt_disable[i];
+		cpu.flags.decimal_mode = lanes.decimal_mode[i];
+		cpu.program_counter = pc;
+		cpu.time = group_time[i] + elapsed;
+		cpu.instructions += instructions;
+	}
+}
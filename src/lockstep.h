@@ -0,0 +1,92 @@
+#ifndef NESEMU_LOCKSTEP_H
+#define NESEMU_LOCKSTEP_H
+
+#include "nesemu.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+/* Registers of consoles run together, an entry per console, padded to a
+ * whole number of AVX2 registers (see Lockstep). */
+struct Lane_registers {
+	// lanes per AVX2 register
+	static const size_t width = 32;
+
+	std::vector<uint8_t> a, x, y, stack_ptr;
+	std::vector<uint8_t> carry, zero_result, negative_result, overflow;
+	std::vector<uint8_t> interrupt_disable, decimal_mode;
+	// the operand of the current instruction, read and written back by the caller
+	std::vector<uint8_t> m;
+
+	void resize(size_t count);
+};
+
+/* Runs instr on the registers (and m, or a if accumulator) of count lanes:
+ * the register, flag, load, compare, arithmetic and read-modify-write
+ * instructions Lockstep groups, everything but stores and control flow. */
+using Exec_lanes = void (*)(Instruction instr, bool accumulator, Lane_registers& lanes, size_t count);
+
+void exec_lanes_generic(Instruction instr, bool accumulator, Lane_registers& lanes, size_t count);
+void exec_lanes_avx2(Instruction instr, bool accumulator, Lane_registers& lanes, size_t count);
+
+// the best version this machine supports
+extern const Exec_lanes exec_lanes;
+
+/* Many consoles running one ROM side by side, e.g. agents playing the same
+ * game with different inputs. They are driven a round at a time: consoles
+ * whose CPUs are at the same ROM address run the straight-line code there
+ * together, with their registers gathered into a struct of arrays so each
+ * instruction is done for 32 consoles per AVX2 operation (SSE2 elsewhere).
+ * Branches and returns keep a group together while all its consoles go the
+ * same way, a load or store to I/O is done per console and ends the group.
+ * Interrupts, idle loops, diverging branches and consoles that are on their
+ * own go through Cpu::step, so every console runs exactly as it would
+ * alone. */
+class Lockstep {
+public:
+	struct Stats {
+		// instructions run as part of a group, summed over its consoles
+		uint64_t vector_instructions;
+		// instructions run by Cpu::step
+		uint64_t scalar_instructions;
+		// groups formed and the consoles in them
+		uint64_t groups;
+		uint64_t group_lanes;
+	};
+
+	Lockstep(const std::string& rom_path, size_t count);
+
+	size_t size() const;
+	Console& console(size_t lane);
+
+	// runs every console up to the end of its current frame
+	void run_frame();
+
+	Stats stats{};
+
+private:
+	// fewer consoles at one address are stepped one by one
+	static const size_t min_group = 4;
+
+	std::vector<std::unique_ptr<Console>> consoles;
+
+	// the group being run: its consoles, their registers, internal RAM and
+	// CPU time when the group started
+	std::vector<size_t> group;
+	Lane_registers lanes;
+	std::vector<uint8_t*> group_ram;
+	std::vector<Master_time> group_time;
+	// idle loops of the group, left to Cpu::step
+	std::vector<std::pair<uint16_t, uint16_t>> idle_loops;
+
+	void step(size_t lane);
+	bool can_group(size_t lane) const;
+	void run_group(uint16_t pc);
+	bool run_instruction(Console& leader, uint16_t& pc, Master_time& elapsed, bool& last);
+	void gather();
+	void scatter(uint16_t pc, Master_time elapsed, uint64_t instructions);
+};
+
+#endif
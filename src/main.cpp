@@ -1,6 +1,8 @@
 #include <iostream>
+#include <chrono>
 
 #include "nesemu.h"
+#include "screen.h"
 #include "common.h"
 #include "config.h"
 
@@ -28,53 +30,70 @@ Button sdl_to_button(int x)
 	}
 }
 
-void run_loop(Console& console)
+void print_speed(Cpu& cpu, std::chrono::steady_clock::time_point start, uint64_t start_cycles)
+{
+	std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+	auto cycles = cpu.cycles() - start_cycles;
+	logger << cycles << " CPU cycles in " << seconds.count() << " s, "
+		<< cycles / seconds.count() / 1e6 << " MHz emulated ("
+		<< cycles * cpu_cycle_ticks * 100.0 / master_clock_rate / seconds.count() << "% of real time)\n";
+}
+
+void run_loop(Console& console, Screen& screen, bool stats)
 {
 	SDL_Event event;
-	unsigned cpu_cycles = 0;
+	auto start = std::chrono::steady_clock::now();
+	auto start_cycles = console.cpu.cycles();
 
 	for (;;) {
-		if (cpu_cycles == 0) {
-			while (SDL_PollEvent(&event)) {
-				switch (event.type) {
-				case SDL_QUIT:
-					return;
-				case SDL_KEYDOWN:
-					switch (event.key.keysym.sym) {
-					case JOYPAD_1_A:
-					case JOYPAD_1_B:
-					case JOYPAD_1_SELECT:
-					case JOYPAD_1_START:
-					case JOYPAD_1_UP:
-					case JOYPAD_1_DOWN:
-					case JOYPAD_1_LEFT:
-					case JOYPAD_1_RIGHT:
-						screen.set_joypad_state(0, sdl_to_button(event.key.keysym.sym));
-						break;
-					}
+		while (SDL_PollEvent(&event)) {
+			switch (event.type) {
+			case SDL_QUIT:
+				if (stats) {
+					print_speed(console.cpu, start, start_cycles);
+				}
+				return;
+			case SDL_KEYDOWN:
+				switch (event.key.keysym.sym) {
+				case JOYPAD_1_A:
+				case JOYPAD_1_B:
+				case JOYPAD_1_SELECT:
+				case JOYPAD_1_START:
+				case JOYPAD_1_UP:
+				case JOYPAD_1_DOWN:
+				case JOYPAD_1_LEFT:
+				case JOYPAD_1_RIGHT:
+					screen.set_joypad_state(0, sdl_to_button(event.key.keysym.sym));
 					break;
-				case SDL_KEYUP:
-					switch (event.key.keysym.sym) {
-					case JOYPAD_1_A:
-					case JOYPAD_1_B:
-					case JOYPAD_1_SELECT:
-					case JOYPAD_1_START:
-					case JOYPAD_1_UP:
-					case JOYPAD_1_DOWN:
-					case JOYPAD_1_LEFT:
-					case JOYPAD_1_RIGHT:
-						screen.clear_joypad_state(0, sdl_to_button(event.key.keysym.sym));
-						break;
-					}
+				}
+				break;
+			case SDL_KEYUP:
+				switch (event.key.keysym.sym) {
+				case JOYPAD_1_A:
+				case JOYPAD_1_B:
+				case JOYPAD_1_SELECT:
+				case JOYPAD_1_START:
+				case JOYPAD_1_UP:
+				case JOYPAD_1_DOWN:
+				case JOYPAD_1_LEFT:
+				case JOYPAD_1_RIGHT:
+					screen.clear_joypad_state(0, sdl_to_button(event.key.keysym.sym));
 					break;
 				}
+				break;
 			}
-
-			cpu_cycles = cpu.step();
 		}
 
-		ppu.step();
-		--cpu_cycles;
+		console.scheduler.run_frame();
+
+		if (stats) {
+			auto& render = console.ppu.render_stats;
+			logger << "frame " << console.ppu.frame_count() << ": "
+				<< console.cpu.idle_stats.last_frame << " idle cycles skipped, "
+				<< render.line_path << " lines drawn in one pass ("
+				<< render.background_reused << " reusing the background), "
+				<< render.dot_path << " dot by dot\n";
+		}
 	}
 }
 
@@ -82,13 +101,33 @@ int main(int argc, char** argv)
 {
 	Console console;
 
+	bool use_jit = false;
+	bool stats = false;
+
+	for (int i = 1; i < argc - 1; ++i) {
+		std::string option{ argv[i] };
+		if (option == "--jit") {
+			use_jit = true;
+		} else if (option == "--stats") {
+			stats = true;
+		} else {
+			argc = 0;
+		}
+	}
 	if (argc < 2) {
-		logger << "not enough arguments...\n";
+		logger << "usage: nesemu [--jit] [--stats] rom.nes\n";
 		return EXIT_FAILURE;
 	}
 
-	console.load(argv[1]);
-	run_loop(console);
+	console.load(argv[argc - 1]);
+	console.cpu.set_jit(use_jit);
+
+	Screen screen;
+	console.video.set_sink(&screen);
+	console.controllers.set_input(&screen);
+	run_loop(console, screen, stats);
+	console.video.set_sink(nullptr);
+	console.controllers.set_input(nullptr);
 
 	return EXIT_SUCCESS;
 }
@@ -1,58 +1,68 @@
 #include "mapper0.h"
+#include "../memory.h"
+#include "../ppu.h"
 
 #include <cassert>
 
-static size_t banks_count;
-static int banks[2];
-
-uint8_t mapper0_read(Extended_addr addr);
-void mapper0_write(Extended_addr addr, uint8_t value);
+uint8_t mapper0_read(Cartridge& cart, uint16_t addr);
+void mapper0_write(Cartridge& cart, uint16_t addr, uint8_t value);
+void mapper0_map(Cartridge& cart, Memory& memory);
 
 void init_mapper0(Mapper& mapper)
 {
 	mapper.read = mapper0_read;
 	mapper.write = mapper0_write;
-
-	banks_count = 0;
-	banks[0] = 0;
-	banks[1] = 0;
+	mapper.map = mapper0_map;
 }
 
-uint8_t mapper0_read(Extended_addr addr)
+uint8_t mapper0_read(Cartridge& cart, uint16_t addr)
 {
 	switch (addr) {
 	case 0x0000 ... 0x1FFF:
-		return cart->vrom.at(addr);
+		return cart.vrom.at(addr);
 	case 0x6000 ... 0x7FFF:
 		GLOBAL_ERROR("save ram read");
 	case 0x8000 ... 0xBFFF:
 	{
-		auto index = banks[0] * 0x4000 + addr - 0x8000;
-		return cart->rom.at(index);
+		auto index = cart.banks[0] * 0x4000 + addr - 0x8000;
+		return cart.rom.at(index);
 	}
 	case 0xC000 ... 0xFFFF:
 	{
-		auto index = banks[1] * 0x4000 + addr - 0xC000;
-		return cart->rom.at(index);
+		auto index = cart.banks[1] * 0x4000 + addr - 0xC000;
+		return cart.rom.at(index);
 	}
 	default:
 		GLOBAL_ERROR(std::to_string(addr).c_str());
 	}
 }
 
-void mapper0_write(Extended_addr addr, uint8_t value)
+void mapper0_write(Cartridge& cart, uint16_t addr, uint8_t value)
 {
 	switch (addr) {
 	case 0x0000 ... 0x1FFF:
-		cart->vrom.at(addr) = value;
+		cart.vrom.at(addr) = value;
+		if (cart.ppu) {
+			cart.ppu->chr_written(addr);
+		}
 		break;
 	case 0x6000 ... 0x7FFF:
 		GLOBAL_ERROR("save ram write");
 	case 0x8000 ... 0xFFFF:
 		assert(0);
-		banks[0] = value % banks_count; // ???
+		cart.banks[0] = value % cart.banks_count; // ???
 		break;
 	default:
 		GLOBAL_ERROR(std::to_string(addr).c_str());
 	}
-}
\ No newline at end of file
+}
+
+void mapper0_map(Cartridge& cart, Memory& memory)
+{
+	// NROM-128 mirrors its only bank, NROM-256 has the second one fixed at $C000
+	cart.banks_count = cart.rom.size() / rom_page_size;
+	cart.banks[1] = cart.banks_count - 1;
+
+	memory.map(0x8000, rom_page_size, &cart.rom.at(cart.banks[0] * rom_page_size), false);
+	memory.map(0xC000, rom_page_size, &cart.rom.at(cart.banks[1] * rom_page_size), false);
+}
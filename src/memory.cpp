@@ -1,20 +1,53 @@
 #include "memory.h"
 #include "common.h"
 #include "controller.h"
-
-Memory memory;
+#include "nesemu.h"
 
 #include <cassert>
 #include <sstream>
 
-uint8_t Memory::read(Extended_addr addr)
+Memory::Memory(Console& console)
+	: cpu(console.cpu)
+	, ppu(console.ppu)
+	, controllers(console.controllers)
+	, cart(console.cart)
+{
+	read_pages.fill(nullptr);
+	write_pages.fill(nullptr);
+
+	// internal RAM is mirrored four times over $0000-$1FFF
+	for (uint16_t addr = 0; addr < 0x2000; addr += internal_ram) {
+		set_pages(addr, internal_ram, ram.data(), true);
+	}
+}
+
+void Memory::set_pages(uint16_t addr, size_t size, uint8_t* data, bool writable)
+{
+	for (size_t offset = 0; offset < size; offset += page_size) {
+		auto page = (addr + offset) / page_size;
+		read_pages.at(page) = data ? data + offset : nullptr;
+		write_pages.at(page) = data && writable ? data + offset : nullptr;
+	}
+}
+
+void Memory::map(uint16_t addr, size_t size, uint8_t* data, bool writable)
+{
+	set_pages(addr, size, data, writable);
+	cpu.invalidate(addr, size);
+}
+
+void Memory::unmap(uint16_t addr, size_t size)
+{
+	set_pages(addr, size, nullptr, false);
+	cpu.invalidate(addr, size);
+}
+
+uint8_t Memory::read_io(uint16_t addr)
 {
 	switch (addr) {
-	case a_register_ext_addr:
-		return cpu.a;
-	case 0 ... 0x1FFF:
-		return ram.at(addr % 0x800);
 	case 0x2000 ... 0x3FFF:
+		// the PPU may be behind in a scheduler batch
+		ppu.run_until(cpu.time);
 		return ppu.read_register(0x2000 + addr % 8);
 	case 0x4014:
 		return ppu.read_register(addr);
@@ -32,23 +65,19 @@ uint8_t Memory::read(Extended_addr addr)
 	}
 }
 
-void Memory::write(Extended_addr addr, uint8_t value)
+void Memory::write_io(uint16_t addr, uint8_t value)
 {
 	switch (addr) {
-	case a_register_ext_addr:
-		cpu.a = value;
-		break;
-	case 0 ... 0x1FFF:
-		ram.at(addr % 0x800) = value;
-		break;
 	case 0x2000 ... 0x3FFF:
 		addr = 0x2000 + addr % 0x8;
+		ppu.run_until(cpu.time);
 		ppu.write_register(addr, value);
 		break;
 	case 0x4000 ... 0x4013:
 		LOG("APU register write");
 		break;
 	case 0x4014:
+		ppu.run_until(cpu.time);
 		ppu.write_register(addr, value);
 		break;
 	case 0x4015:
@@ -69,7 +98,7 @@ void Memory::write(Extended_addr addr, uint8_t value)
 	}
 }
 
-uint16_t Memory::read_addr(Extended_addr addr)
+uint16_t Memory::read_addr(uint16_t addr)
 {
 	return read(addr) + 0x100 * read(addr + 1);
 }
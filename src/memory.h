@@ -2,6 +2,7 @@
 #define NESEMU_MEMORY_H
 
 #include <array>
+#include <memory>
 #include <cstdint>
 
 #include "cpu.h"
@@ -11,24 +12,95 @@
 class Cpu;
 class Ppu;
 class Cartridge;
+class Controllers;
+class Console;
 
 const size_t memory_size = 0x10000;
 const size_t internal_ram = 0x800;
 const size_t page_size = 0x100;
+const size_t page_count = memory_size / page_size;
 
 class Memory {
 public:
-	uint8_t read(Extended_addr addr);
-	uint16_t read_addr(Extended_addr addr);
-	void write(Extended_addr addr, uint8_t value);
+	explicit Memory(Console& console);
+
+	Memory(const Memory&) = delete;
+	Memory& operator=(const Memory&) = delete;
+
+	uint8_t read(uint16_t addr);
+	uint16_t read_addr(uint16_t addr);
+	void write(uint16_t addr, uint8_t value);
+
+	/* Point the pages covering [addr, addr + size) directly at host memory.
+	 * Pages that are not mapped (or not writable) go through the I/O handlers. */
+	void map(uint16_t addr, size_t size, uint8_t* data, bool writable);
+	void unmap(uint16_t addr, size_t size);
+
+	// mapped for reading but not for writing, i.e. ROM
+	bool immutable(uint16_t addr) const;
+	// served from the page table, i.e. not an I/O register
+	bool direct(uint16_t addr, bool write) const;
+	// host address backing addr, nullptr for I/O
+	uint8_t* host(uint16_t addr, bool write) const;
+	// the internal RAM, to look at a running game from outside
+	const uint8_t* ram_data() const;
 
 private:
-	std::array<uint8_t, internal_ram> ram;
-	uint8_t& at(Extended_addr addr);
+	// the rest of the console
+	Cpu& cpu;
+	Ppu& ppu;
+	Controllers& controllers;
+	std::unique_ptr<Cartridge>& cart;
+
+	std::array<uint8_t, internal_ram> ram{};
+
+	// one entry per 256 byte page, nullptr means "ask read_io/write_io"
+	std::array<uint8_t*, page_count> read_pages;
+	std::array<uint8_t*, page_count> write_pages;
+
+	void set_pages(uint16_t addr, size_t size, uint8_t* data, bool writable);
+	uint8_t read_io(uint16_t addr);
+	void write_io(uint16_t addr, uint8_t value);
 };
 
+inline uint8_t Memory::read(uint16_t addr)
+{
+	auto page = read_pages[addr / page_size];
+	if (page) {
+		return page[addr % page_size];
+	}
+	return read_io(addr);
+}
+
+inline void Memory::write(uint16_t addr, uint8_t value)
+{
+	auto page = write_pages[addr / page_size];
+	if (page) {
+		page[addr % page_size] = value;
+		return;
+	}
+	write_io(addr, value);
+}
+
+inline bool Memory::immutable(uint16_t addr) const
+{
+	return read_pages[addr / page_size] && !write_pages[addr / page_size];
+}
+
+inline bool Memory::direct(uint16_t addr, bool write) const
+{
+	return (write ? write_pages : read_pages)[addr / page_size] != nullptr;
+}
+
+inline const uint8_t* Memory::ram_data() const
+{
+	return ram.data();
+}
 
-extern Ppu ppu;
-extern Cpu cpu;
+inline uint8_t* Memory::host(uint16_t addr, bool write) const
+{
+	auto page = (write ? write_pages : read_pages)[addr / page_size];
+	return page ? page + addr % page_size : nullptr;
+}
 
 #endif
@@ -0,0 +1,66 @@
+#include "movie.h"
+
+#include <string>
+#include <sstream>
+
+// a port's buttons in "RLDUTSBA" order
+static uint8_t parse_port(const std::string& field)
+{
+	uint8_t state = 0;
+	for (size_t i = 0; i < field.size() && i < 8; ++i) {
+		if (field[i] != '.' && field[i] != ' ') {
+			// A is bit 0 of a joypad state, right bit 7
+			state |= BIT(7 - i);
+		}
+	}
+	return state;
+}
+
+Movie Movie::from_fm2(std::istream& file)
+{
+	Movie movie;
+
+	std::string line;
+	while (std::getline(file, line)) {
+		if (line.compare(0, 8, "binary 1") == 0) {
+			GLOBAL_ERROR("binary movies are not supported");
+		}
+		if (line.empty() || line[0] != '|') {
+			continue;
+		}
+
+		// "|commands|port0|port1|port2|"
+		std::istringstream fields{ line.substr(1) };
+		std::string commands, port0, port1;
+		std::getline(fields, commands, '|');
+		std::getline(fields, port0, '|');
+		std::getline(fields, port1, '|');
+
+		movie.frames.push_back({ parse_port(port0), parse_port(port1) });
+	}
+
+	return movie;
+}
+
+uint8_t Movie::joypad_state(int controller_number)
+{
+	if (frame >= frames.size()) {
+		return 0;
+	}
+	return frames[frame].at(controller_number);
+}
+
+void Movie::next_frame()
+{
+	++frame;
+}
+
+void Movie::rewind()
+{
+	frame = 0;
+}
+
+size_t Movie::frame_count() const
+{
+	return frames.size();
+}
@@ -0,0 +1,31 @@
+#ifndef NESEMU_MOVIE_H
+#define NESEMU_MOVIE_H
+
+#include "controller.h"
+
+#include <array>
+#include <vector>
+#include <istream>
+#include <cstdint>
+
+/* Recorded buttons played back one frame at a time, read from the text
+ * FM2 format of FCEUX: each "|commands|port0|port1|..." line holds a frame,
+ * a port's buttons written as "RLDUTSBA" with '.' or ' ' where released.
+ * Header lines and the commands (resets) are ignored. */
+class Movie : public Input_source {
+public:
+	static Movie from_fm2(std::istream& file);
+
+	uint8_t joypad_state(int controller_number) override;
+
+	// moves on to the next frame's buttons, past the end none are pressed
+	void next_frame();
+	void rewind();
+	size_t frame_count() const;
+
+private:
+	std::vector<std::array<uint8_t, 2>> frames;
+	size_t frame = 0;
+};
+
+#endif
@@ -1,23 +1,59 @@
 #ifndef NESEMU_CONSOLE_H
 #define NESEMU_CONSOLE_H
 
-#include "screen.h"
+#include "video.h"
+#include "controller.h"
 #include "cpu.h"
 #include "ppu.h"
 #include "memory.h"
+#include "recompiled.h"
+#include "scheduler.h"
+#include "cart.h"
 
 #include <iostream>
+#include <fstream>
 #include <memory>
 
+/* One emulated NES: every piece of its state lives here, so any number of
+ * consoles can run side by side, each on one thread at a time. */
 class Console {
 public:
+	// declared first: the other parts keep a reference to it
+	std::unique_ptr<Cartridge> cart;
+	Cpu cpu;
+	Ppu ppu;
+	Memory memory;
+	Controllers controllers;
+	Scheduler scheduler;
+	Video video;
+
+	Console()
+		: cpu(*this)
+		, ppu(*this)
+		, memory(*this)
+		, scheduler(*this)
+	{
+	}
+
+	Console(const Console&) = delete;
+	Console& operator=(const Console&) = delete;
+
 	void load(std::string path)
 	{
 		std::ifstream file{ path, std::ios::binary };
 		if (!file.is_open()) {
 			GLOBAL_ERROR("file error");
 		}
-		cart = Cartridge::from_ines(file);
+		load(file);
+	}
+
+	// an iNES image, from a file or e.g. a buffer the ROM was handed over in
+	void load(std::istream& rom)
+	{
+		cart.reset(Cartridge::from_ines(rom));
+		cart->ppu = &ppu;
+		cart->map(memory);
+		cpu.set_recompiled(Recompiled::find(Recompiled::crc(cart->rom)));
 		ppu.reset();
 		cpu.reset();
 	}
@@ -0,0 +1,124 @@
+#include "nesemu_c.h"
+#include "nesemu.h"
+
+#include <sstream>
+#include <string>
+#include <new>
+
+std::ostream& logger = std::clog;
+
+static_assert(NESEMU_DISPLAY_WIDTH == display_width && NESEMU_DISPLAY_HEIGHT == display_height,
+	"the C display size is out of date");
+static_assert(sizeof(Pixel) == 1 && sizeof(Color) == 4, "the C frame types are out of date");
+
+// the buttons last set through nesemu_set_input
+class Held_buttons : public Input_source {
+public:
+	uint8_t buttons[2] = {};
+
+	uint8_t joypad_state(int controller_number) override
+	{
+		return controller_number == 0 || controller_number == 1 ? buttons[controller_number] : 0;
+	}
+};
+
+struct nesemu_console {
+	Console console;
+	Held_buttons input;
+};
+
+nesemu_console* nesemu_create(const uint8_t* rom, size_t size)
+{
+	// checked up front: a bad image would end the host process in from_ines
+	if (!rom || !Cartridge::supports_ines(rom, size)) {
+		return nullptr;
+	}
+
+	// no exception may unwind into C
+	auto* console = new (std::nothrow) nesemu_console;
+	if (!console) {
+		return nullptr;
+	}
+	try {
+		std::istringstream image{ std::string{ reinterpret_cast<const char*>(rom), size } };
+		console->console.load(image);
+	} catch (...) {
+		delete console;
+		return nullptr;
+	}
+	console->console.controllers.set_input(&console->input);
+	return console;
+}
+
+void nesemu_destroy(nesemu_console* console)
+{
+	delete console;
+}
+
+void nesemu_set_input(nesemu_console* console, int controller, uint8_t buttons)
+{
+	if (controller == 0 || controller == 1) {
+		console->input.buttons[controller] = buttons;
+	}
+}
+
+void nesemu_run_frames(nesemu_console* console, unsigned frames)
+{
+	for (unsigned i = 0; i < frames; ++i) {
+		console->console.scheduler.run_frame();
+	}
+}
+
+unsigned nesemu_frame_count(const nesemu_console* console)
+{
+	return console->console.ppu.frame_count();
+}
+
+uint64_t nesemu_cpu_cycles(const nesemu_console* console)
+{
+	return console->console.cpu.cycles();
+}
+
+const uint8_t* nesemu_frame(const nesemu_console* console)
+{
+	return &console->console.video.frame().pixels[0][0];
+}
+
+const uint8_t* nesemu_frame_emphasis(const nesemu_console* console)
+{
+	return console->console.video.frame().emphasis;
+}
+
+const uint32_t* nesemu_colors(uint8_t emphasis)
+{
+	return frame_colors(emphasis);
+}
+
+const uint8_t* nesemu_ram(const nesemu_console* console)
+{
+	return console->console.memory.ram_data();
+}
+
+const uint8_t* nesemu_nametables(const nesemu_console* console)
+{
+	return console->console.ppu.nametables();
+}
+
+const uint8_t* nesemu_palettes(const nesemu_console* console)
+{
+	return console->console.ppu.palettes();
+}
+
+const uint8_t* nesemu_oam(const nesemu_console* console)
+{
+	return console->console.ppu.oam();
+}
+
+const uint8_t* nesemu_chr(const nesemu_console* console, size_t* size)
+{
+	auto& chr = console->console.cart->vrom;
+	if (size) {
+		*size = chr.size();
+	}
+	return chr.data();
+}
@@ -0,0 +1,70 @@
+#ifndef NESEMU_C_H
+#define NESEMU_C_H
+
+/* A C interface to the emulator core, for driving it from other languages
+ * (e.g. Python through ctypes) without SDL. Built as libnesemu.so by
+ * `make libnesemu.so`.
+ *
+ * The views below point straight into the console, nothing is copied:
+ * they stay valid as long as the console, except the frame, which is only
+ * valid until the next nesemu_run_frames. They are read-only, the console
+ * caches what it derives from them. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The library is built with hidden visibility, only these are exported. */
+#if defined(__GNUC__)
+#define NESEMU_API __attribute__((visibility("default")))
+#else
+#define NESEMU_API
+#endif
+
+#define NESEMU_DISPLAY_WIDTH 256
+#define NESEMU_DISPLAY_HEIGHT 240
+
+typedef struct nesemu_console nesemu_console;
+
+/* A console with the iNES image in rom inserted and powered on, NULL if
+ * rom is no such image, has no PRG or CHR ROM (CHR RAM is not supported
+ * yet) or needs a mapper that is not implemented. The image is copied, rom
+ * can be freed right after. */
+NESEMU_API nesemu_console* nesemu_create(const uint8_t* rom, size_t size);
+NESEMU_API void nesemu_destroy(nesemu_console* console);
+
+/* The buttons held on controller 0 or 1 from now on: A in bit 0, B, select,
+ * start, up, down, left, right in bit 7. Other controller numbers are
+ * ignored. */
+NESEMU_API void nesemu_set_input(nesemu_console* console, int controller, uint8_t buttons);
+
+/* Runs until the PPU has completed this many more frames. */
+NESEMU_API void nesemu_run_frames(nesemu_console* console, unsigned frames);
+NESEMU_API unsigned nesemu_frame_count(const nesemu_console* console);
+NESEMU_API uint64_t nesemu_cpu_cycles(const nesemu_console* console);
+
+/* The last completed frame: NESEMU_DISPLAY_HEIGHT rows of
+ * NESEMU_DISPLAY_WIDTH palette indices (0-63), and the emphasis bits of
+ * each row, which pick the colors the indices stand for. */
+NESEMU_API const uint8_t* nesemu_frame(const nesemu_console* console);
+NESEMU_API const uint8_t* nesemu_frame_emphasis(const nesemu_console* console);
+/* 64 colors (0xRRGGBB) of the palette indices under an emphasis. */
+NESEMU_API const uint32_t* nesemu_colors(uint8_t emphasis);
+
+/* The 2 KB internal RAM at $0000. */
+NESEMU_API const uint8_t* nesemu_ram(const nesemu_console* console);
+/* PPU memory: 2 KB of nametables, 32 bytes of palettes, 256 of OAM. */
+NESEMU_API const uint8_t* nesemu_nametables(const nesemu_console* console);
+NESEMU_API const uint8_t* nesemu_palettes(const nesemu_console* console);
+NESEMU_API const uint8_t* nesemu_oam(const nesemu_console* console);
+/* The cartridge's pattern tables, size set to their length in bytes. */
+NESEMU_API const uint8_t* nesemu_chr(const nesemu_console* console, size_t* size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
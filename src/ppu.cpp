@@ -1,26 +1,73 @@
 #include "ppu.h"
+#include "scheduler.h"
+#include "nesemu.h"
 
-Ppu ppu;
+#include <algorithm>
+#include <cstring>
 
-uint16_t nt_mirror(uint16_t addr);
+const unsigned Ppu::max_line_sprites;
 
-
-Ppu::Ppu()
+Ppu::Ppu(Console& console)
+	: cpu(console.cpu)
+	, memory(console.memory)
+	, scheduler(console.scheduler)
+	, video(console.video)
+	, cart(console.cart)
 {
 	reset();
 }
 
 void Ppu::reset()
 {
-	cycle = 340;
 	scan_line = 240;
 	frame = 0;
 	control.raw = 0;
 	mask.raw = 0;
 	oam_address = 0;
+	sprites_indexed = false;
 	w = 0;
 	dot = 0;
 	f = 0;
+	if (cart) {
+		chr_tiles.decode(cart->vrom);
+	}
+	++vram_generation;
+}
+
+uint64_t Tile_cache::decode_row(uint8_t low, uint8_t high)
+{
+	uint64_t row = 0;
+	for (int i = 0; i < 8; ++i) {
+		uint64_t color = ((low >> (7 - i)) & 1) | (((high >> (7 - i)) & 1) << 1);
+		row |= color << (8 * i);
+	}
+	return row;
+}
+
+void Tile_cache::decode(const std::vector<uint8_t>& chr)
+{
+	for (uint16_t addr = 0; addr < 0x2000 && addr < chr.size(); ++addr) {
+		if (!(addr & 8)) {
+			update(chr, addr);
+		}
+	}
+}
+
+void Tile_cache::update(const std::vector<uint8_t>& chr, uint16_t addr)
+{
+	addr &= ~8;
+	if (addr + 8u >= chr.size()) {
+		return;
+	}
+	auto row = decode_row(chr[addr], chr[addr + 8]);
+	rows[index(addr)] = row;
+	flipped_rows[index(addr)] = __builtin_bswap64(row);
+}
+
+void Ppu::chr_written(uint16_t addr)
+{
+	chr_tiles.update(cart->vrom, addr);
+	++vram_generation;
 }
 
 uint8_t Ppu::read(uint16_t addr)
@@ -49,10 +96,18 @@ void Ppu::write(uint16_t addr, uint8_t value)
 	switch (addr) {
 	case 0 ... 0x1FFF:
 		cart->vrom.at(addr) = value;
+		chr_written(addr);
 		break;
 	case 0x2000 ... 0x3EFF:
-		nametable_data.at(nt_mirror(addr)) = value;
+	{
+		auto index = nt_mirror(addr);
+		nametable_data.at(index) = value;
+		if ((index & 0x3FF) >= 0x3C0) {
+			update_tile_palettes(index);
+		}
+		++vram_generation;
 		break;
+	}
 	case 0x3F00 ... 0x3FFF:
 		if ((addr & 0x13) == 0x10) {
 			addr &= ~0x10;
@@ -90,13 +145,113 @@ uint8_t Ppu::read_register(uint16_t address)
 	return 0;
 }
 
+uint8_t Ppu::peek_status() const
+{
+	return (status.raw & 0xE0) | (reg & 0x1F);
+}
+
+/* Conservative: the earliest dot at which the vblank flag is set or
+ * cleared, sprite 0 could hit or the sprite overflow could be set.
+ * Stops at the end of the frame, where the odd frame dot skip happens. */
+unsigned Ppu::dots_until_event()
+{
+	const unsigned vblank_set = 241 * line_dots + 1;
+	const unsigned flags_cleared = 261 * line_dots + 1;
+
+	unsigned now = scan_line * line_dots + dot;
+	unsigned event = frame_lines * line_dots - 1;
+
+	if (now <= vblank_set) {
+		event = vblank_set;
+	} else if (now <= flags_cleared) {
+		event = flags_cleared;
+	}
+
+	// sprites per line, for the overflow set by the evaluation at dot 257
+	if (!sprites_indexed) {
+		index_sprites();
+	}
+
+	for (unsigned line = scan_line; line < 240 && line * line_dots < event; ++line) {
+		if (!status.sprite_overflow && line_sprite_counts[line] > 8
+			&& now <= line * line_dots + 257) {
+			event = std::min(event, line * line_dots + 257);
+		}
+
+		// sprite 0 hit, on lines whose sprites come from evaluating the one before
+		bool sprite_zero = false;
+		if (line == scan_line || line == scan_line + 1) {
+			for (int i = 0; i < 8; ++i) {
+				sprite_zero |= primary_oam.sprite_at(i).id == 0;
+			}
+		}
+		int row = (int)line - 1 - oam_data[0];
+		sprite_zero |= row >= 0 && row < spr_height();
+
+		if (sprite_zero && !status.sprite_zero_hit
+			&& mask.show_background && mask.show_sprites
+			&& now <= line * line_dots + 257) {
+			event = std::min(event, std::max(now, line * line_dots + 2));
+		}
+	}
+
+	return event - now;
+}
+
+unsigned Ppu::frame_count() const
+{
+	return frame;
+}
+
+const uint8_t* Ppu::nametables() const
+{
+	return nametable_data.data();
+}
+
+const uint8_t* Ppu::palettes() const
+{
+	return palette_data.raw();
+}
+
+const uint8_t* Ppu::oam() const
+{
+	return oam_data.data();
+}
+
+/* When the PPU gets to the given dot of this frame, or of the next one if
+ * it is already past it. Never late: the odd frame dot is assumed skipped. */
+Master_time Ppu::time_of(unsigned line, unsigned line_dot) const
+{
+	unsigned now = scan_line * line_dots + dot;
+	unsigned target = line * line_dots + line_dot;
+	if (target < now) {
+		target += frame_lines * line_dots - (f ? 1 : 0);
+	}
+	return time + (Master_time)(target - now) * ppu_dot_ticks;
+}
+
+void Ppu::post_events(Scheduler& scheduler) const
+{
+	if (control.nmi_output) {
+		scheduler.post(Scheduler::Event::nmi, time_of(241, 1));
+	} else {
+		scheduler.cancel(Scheduler::Event::nmi);
+	}
+	scheduler.post(Scheduler::Event::frame_end, time_of(240, 0));
+}
+
 void Ppu::write_register(uint16_t address, uint8_t value)
 {
 	reg = value;
 	switch (address) {
 	case 0x2000:
+		if (((value >> 5) & 1) != control.sprite_size) {
+			sprites_indexed = false;
+		}
 		control.raw = value;
 		t.nt_select = value;
+		// NMIs may have been switched on or off
+		post_events(scheduler);
 		break;
 	case 0x2001:
 		mask.raw = value;
@@ -105,9 +260,7 @@ void Ppu::write_register(uint16_t address, uint8_t value)
 		oam_address = value;
 		break;
 	case 0x2004:
-
-		oam_data.at(oam_address) = value;
-		++oam_address;
+		write_oam(value);
 		break;
 	case 0x2005:
 		if (w == 0) {
@@ -139,16 +292,25 @@ void Ppu::write_register(uint16_t address, uint8_t value)
 	{
 		auto address = value << 8;
 		for (auto i = 0; i < 256; ++i) {
-			oam_data.at(oam_address) = memory.read(address);
-			++oam_address;
+			write_oam(memory.read(address));
 			++address;
 		}
-		cpu.stall(cpu.cycle % 2 == 1 ? 514 : 513);
+		cpu.stall(cpu.cycles() % 2 == 1 ? 514 : 513);
 		break;
 	}
 	}
 }
 
+void Ppu::write_oam(uint8_t value)
+{
+	auto& byte = oam_data.at(oam_address);
+	if (oam_address % 4 == 0 && byte != value) {
+		sprites_indexed = false;
+	}
+	byte = value;
+	++oam_address;
+}
+
 void Ppu::incr_x()
 {
 	if (!rendering()) {
@@ -207,7 +369,7 @@ int Ppu::spr_height()
 }
 
 /* Get CIRAM address according to mirroring */
-uint16_t nt_mirror(uint16_t addr)
+uint16_t Ppu::nt_mirror(uint16_t addr)
 {
 	switch (cart->mirroring) {
 	case Mirroring::vertical:
@@ -226,6 +388,31 @@ uint16_t Ppu::nt_addr()
 	return 0x2000 | (v.raw & 0xFFF);
 }
 
+/* Expand the attribute byte at index in nametable_data into the palettes of
+ * the 4x4 tiles it covers. The last attribute row covers rows 28-31: rows
+ * 30 and 31 (the attribute bytes, drawn as tiles when scrolled to) take its
+ * bottom quadrants, as at_addr decodes them. */
+void Ppu::update_tile_palettes(uint16_t index)
+{
+	uint8_t value = nametable_data[index];
+	unsigned table = index & ~0x3FF;
+	unsigned top = (index & 0x3F) / 8 * 4;
+	unsigned left = (index & 7) * 4;
+
+	for (unsigned tile_y = top; tile_y < top + 4; ++tile_y) {
+		for (unsigned tile_x = left; tile_x < left + 4; ++tile_x) {
+			// quadrants: bits 0-1 top left, 2-3 top right, 4-5 bottom left, 6-7 bottom right
+			unsigned shift = ((tile_y & 2) << 1) | (tile_x & 2);
+			tile_palettes[table + tile_y * 32 + tile_x] = (value >> shift) & 3;
+		}
+	}
+}
+
+uint8_t Ppu::tile_palette()
+{
+	return tile_palettes[nt_mirror(nt_addr())];
+}
+
 uint16_t Ppu::at_addr()
 {
 	return 0x23C0 | (v.nt_select << 10) | ((v.coarse_y / 4) << 3) | (v.coarse_x / 4);
@@ -250,42 +437,67 @@ void Ppu::reload_shift()
 template <size_t Sz>
 void Sprite_data<Sz>::clear()
 {
-	for (auto& sprite : sprites) {
+	for (size_t i = 0; i < used; ++i) {
+		auto& sprite = sprites[i];
 		sprite.y = 0xFF;
 		sprite.id = 64;
 		sprite.y = 0xFF;
 		sprite.index = 0xFF;
 		sprite.attr.raw = 0xFF;
 		sprite.x = 0xFF;
-		sprite.dataL = 0;
-		sprite.dataH = 0;
+		sprite.pixels = 0;
 	}
+	used = 0;
 }
 
 
-/* Fill secondary OAM with the sprite infos for the next scanline */
-void Ppu::eval_sprites()
+/* Bucket the OAM entries by the lines they cover, in OAM order. Only the
+ * first max_line_sprites of a line are kept, that is all evaluation sees. */
+void Ppu::index_sprites()
 {
-	int n = 0;
+	line_sprite_counts.fill(0);
 	for (int i = 0; i < 64; ++i) {
-		int line = (scan_line == 261 ? -1 : scan_line) - oam_data[i * 4 + 0];
-		// If the sprite is in the scanline, copy its properties into secondary OAM:
-		if (line >= 0 && line < spr_height()) {
-			auto& sprite = secondary_oam.sprite_at(n);
-
-			sprite.id       = i;
-			sprite.y        = oam_data[i * 4 + 0];
-			sprite.index    = oam_data[i * 4 + 1];
-			sprite.attr.raw = oam_data[i * 4 + 2];
-			sprite.x        = oam_data[i * 4 + 3];
-
-			++n;
-			if (n > 8) {
-				status.sprite_overflow = true;
-				break;
+		unsigned y = oam_data[i * 4 + 0];
+		for (int row = 0; row < spr_height(); ++row) {
+			auto& count = line_sprite_counts[y + row];
+			if (count < max_line_sprites) {
+				line_sprites[y + row][count] = i;
 			}
+			++count;
 		}
 	}
+	sprites_indexed = true;
+}
+
+/* Fill secondary OAM with the sprite infos for the next scanline */
+void Ppu::eval_sprites()
+{
+	if (scan_line == 261) {
+		// line -1, no sprite is in range
+		return;
+	}
+	if (!sprites_indexed) {
+		index_sprites();
+	}
+
+	// If the sprite is in the scanline, copy its properties into secondary OAM:
+	unsigned count = line_sprite_counts[scan_line];
+	unsigned n = std::min(count, max_line_sprites);
+	for (unsigned j = 0; j < n; ++j) {
+		unsigned i = line_sprites[scan_line][j];
+		auto& sprite = secondary_oam.sprite_at(j);
+
+		sprite.id       = i;
+		sprite.y        = oam_data[i * 4 + 0];
+		sprite.index    = oam_data[i * 4 + 1];
+		sprite.attr.raw = oam_data[i * 4 + 2];
+		sprite.x        = oam_data[i * 4 + 3];
+	}
+	// the 9th sprite found went into slot 0 before the overflow stopped it
+	secondary_oam.used = std::max(secondary_oam.used, std::min<size_t>(n, secondary_oam.size));
+	if (count > 8) {
+		status.sprite_overflow = true;
+	}
 }
 
 /* Load the sprite info into primary OAM and fetch their tile data. */
@@ -308,9 +520,10 @@ void Ppu::load_sprites()
 		}
 		addr += sprY + (sprY & 8);  // Select the second tile if on 8x16.
 
-		sprite.dataL = read(addr + 0);
-		sprite.dataH = read(addr + 8);
+		sprite.pixels = sprite.attr.flip_horizontal
+			? chr_tiles.flipped_row(addr) : chr_tiles.row(addr);
 	}
+	draw_sprite_line();
 }
 
 // tmp
@@ -320,12 +533,58 @@ static inline int NTH_BIT(int x, int n)
 }
 
 
-/* Process a pixel, draw it if it's on screen */
+/* Sprite pixel at x_ on a visible line, composed over the background
+ * palette index palette_nr (0: transparent). Sets the sprite 0 hit. */
+uint8_t Ppu::sprite_pixel(int x_, uint8_t palette_nr)
+{
+	if (!mask.show_sprites || (!mask.show_left_sprites && x_ < 8)) {
+		return palette_nr;
+	}
+	uint8_t sprite = sprite_line[x_];
+
+	if (sprite & sprite_zero && palette_nr && x_ != 255) {
+		status.sprite_zero_hit = 1;
+	}
+	// Evaluate priority:
+	uint8_t obj_palette_nr = sprite & sprite_color_mask;
+	if (obj_palette_nr && (palette_nr == 0 || !(sprite & sprite_behind))) {
+		palette_nr = obj_palette_nr;
+	}
+	return palette_nr;
+}
+
+/* Pre-render the sprites in primary OAM into sprite_line, see compositor.h. */
+void Ppu::draw_sprite_line()
+{
+	sprite_line.fill(0);
+
+	// front-most (lowest) slot last, so it wins
+	for (int i = 7; i >= 0; --i) {
+		auto& sprite = primary_oam.sprite_at(i);
+		if (sprite.id == 64) {
+			continue;
+		}
+		uint8_t flags = ((sprite.attr.raw & 3) << 2) | 16;
+		if (sprite.attr.behind_background) {
+			flags |= sprite_behind;
+		}
+		for (unsigned sprX = 0; sprX < 8 && sprite.x + sprX < line_width; ++sprX) {
+			uint8_t color = sprite.pixels >> (8 * sprX) & 3;
+			if (color == 0) {
+				continue;
+			}
+			auto& pixel = sprite_line[sprite.x + sprX];
+			pixel = (pixel & sprite_zero) | flags | color;
+			if (sprite.id == 0) {
+				pixel |= sprite_zero;
+			}
+		}
+	}
+}
+
 void Ppu::pixel()
 {
 	uint8_t palette_nr = 0;
-	uint8_t obj_palette_nr = 0;
-	bool objPriority = 0;
 	int x_ = dot - 2;
 
 	if (scan_line < 240 && x_ >= 0 && x_ < 256) {
@@ -338,40 +597,12 @@ void Ppu::pixel()
 					| NTH_BIT(attribute_shift_low,  7 - x)) << 2;
 			}
 		}
-		// Sprites:
-		if (mask.show_sprites && !(!mask.show_left_sprites && x_ < 8))
-			for (int i = 7; i >= 0; --i) {
-				auto& sprite = primary_oam.sprite_at(i);
-
-				if (sprite.id == 64) {
-					continue;
-				}
-				unsigned sprX = x_ - sprite.x;
-				if (sprX >= 8) {  // Not in range.
-					continue;
-				}
-				if (sprite.attr.flip_horizontal) {
-					sprX ^= 7;
-				}
-				uint8_t sprPalette = (NTH_BIT(sprite.dataH, 7 - sprX) << 1)
-					| NTH_BIT(sprite.dataL, 7 - sprX);
-				if (sprPalette == 0) {  // Transparent pixel.
-					continue;
-				}
-
-				if (sprite.id == 0 && palette_nr && x_ != 255) {
-					status.sprite_zero_hit = 1;
-				}
-				sprPalette |= (sprite.attr.raw & 3) << 2;
-				obj_palette_nr  = sprPalette + 16;
-				objPriority = sprite.attr.raw & 0x20;
-			}
-		// Evaluate priority:
-		if (obj_palette_nr && (palette_nr == 0 || objPriority == 0)) {
-			palette_nr = obj_palette_nr;
-		}
+		palette_nr = sprite_pixel(x_, palette_nr);
 
-		screen.set_bg(scan_line, x_, palette.at(read(0x3F00 + (rendering() ? palette_nr : 0))));
+		if (x_ == 0) {
+			video.set_emphasis(scan_line, mask.raw >> 5);
+		}
+		video.set_pixel(scan_line, x_, read(0x3F00 + (rendering() ? palette_nr : 0)) & 0x3F);
 	}
 	// Perform background shifts:
 	background_shift_low <<= 1;
@@ -380,157 +611,362 @@ void Ppu::pixel()
 	attribute_shift_high = (attribute_shift_high << 1) | attribute_latch_high;
 }
 
+/* The fetches of dots 2-8 of a tile, from the nametable address set up at
+ * dot 1 to the high pattern byte; the caller does the increment at dot 8. */
+void Ppu::fetch_tile()
+{
+	nametable_byte = read(fetch_addr);
+	attributetable_byte = tile_palette();
+	fetch_addr = bg_addr();
+	low_tile_byte = read(fetch_addr);
+	fetch_addr += 8;
+	high_tile_byte = read(fetch_addr);
+}
 
-/* Execute a cycle of a scanline */
-void Ppu::scanline_cycle(Scanline_type scanline_type)
+/* A whole visible line in one pass, for lines no register access falls in.
+ * Does the fetches of the dot by dot path in the same order, so every
+ * register ends up as it would there, but draws the pixels straight from
+ * the fetched tiles instead of shifting them out one at a time. */
+void Ppu::render_line()
 {
-	static uint16_t addr;
+	struct Tile {
+		uint8_t low, high, attr;
+		uint64_t pixels;
+	};
+	// the two tiles in the shift registers (the second one's attribute in
+	// the latches), then one per fetch
+	Tile tiles[2 + 34];
+
+	// dot 1
+	secondary_oam.clear();
+
+	// dots 1-256 only depend on this and on VRAM, so if neither changed since
+	// the line was last drawn, its background and fetch state are reused
+	Background_key key{ (uint16_t)v.raw, background_shift_low, background_shift_high,
+		x, attribute_shift_low, attribute_shift_high,
+		(uint8_t)(attribute_latch_low | attribute_latch_high << 1
+			| control.background_table << 2 | rendering() << 3) };
+	auto& cached = background_lines[scan_line];
+
+	if (cached.generation == vram_generation && cached.key == key) {
+		v.raw = cached.v;
+		fetch_addr = cached.fetch_addr;
+		nametable_byte = cached.nametable_byte;
+		attributetable_byte = cached.attributetable_byte;
+		low_tile_byte = cached.low_tile_byte;
+		high_tile_byte = cached.high_tile_byte;
+		++frame_render_stats.background_reused;
+	} else {
+		uint8_t low = background_shift_low >> 8;
+		uint8_t high = background_shift_high >> 8;
+		tiles[0] = { low, high, 0, Tile_cache::decode_row(low, high) };
+		low = background_shift_low;
+		high = background_shift_high;
+		tiles[1] = { low, high, (uint8_t)(attribute_latch_high << 1 | attribute_latch_low),
+			Tile_cache::decode_row(low, high) };
+
+		fetch_addr = nt_addr();
+
+		// dots 2-256, a reload every 8 dots from 9 on
+		for (int i = 2; i < 2 + 32; ++i) {
+			fetch_tile();
+			tiles[i] = { low_tile_byte, high_tile_byte, (uint8_t)(attributetable_byte & 3),
+				chr_tiles.row(fetch_addr - 8) };
+			if (i < 2 + 31) {
+				incr_x();
+				fetch_addr = nt_addr();
+			} else {
+				incr_y();
+			}
+		}
+
+		// dots 2-257 draw x_ 0-255: pixel x_ shows tile (x_ + x) / 8, with the
+		// attribute latched along, except in the first tile's span where the
+		// attribute is whatever was left in the shift registers
+		const uint64_t ones = 0x0101010101010101;
+		uint8_t background[33 * 8];
+		for (int i = 0; i < 33; ++i) {
+			uint64_t attr = i == 0
+				? Tile_cache::decode_row(attribute_shift_low, attribute_shift_high)
+				: tiles[i].attr * ones;
+			uint64_t pixels = tiles[i].pixels;
+			uint64_t opaque = ((pixels | pixels >> 1) & ones) * 0xFF;
+			pixels |= opaque & attr << 2;
+			// leftmost pixel in the low byte, x86 is little endian
+			memcpy(&background[i * 8], &pixels, 8);
+		}
+
+		cached.key = key;
+		cached.generation = vram_generation;
+		memcpy(cached.pixels.data(), background + x, line_width);
+		cached.v = v.raw;
+		cached.fetch_addr = fetch_addr;
+		cached.nametable_byte = nametable_byte;
+		cached.attributetable_byte = attributetable_byte;
+		cached.low_tile_byte = low_tile_byte;
+		cached.high_tile_byte = high_tile_byte;
+	}
+
+	uint8_t line[line_width];
+	Line_layers layers{ cached.pixels.data(), sprite_line.data(),
+		mask.show_background != 0, mask.show_left_background != 0,
+		mask.show_sprites != 0, mask.show_left_sprites != 0 };
+	if (compose_line(layers, line)) {
+		status.sprite_zero_hit = 1;
+	}
+
+	// palette RAM through read, for its mirrors and grayscale
+	uint8_t colors[32];
+	for (int i = 0; i < 32; ++i) {
+		colors[i] = read(0x3F00 + (rendering() ? i : 0)) & 0x3F;
+	}
+	video.set_emphasis(scan_line, mask.raw >> 5);
+	auto row = video.row(scan_line);
+	for (int x_ = 0; x_ < 256; ++x_) {
+		row[x_] = colors[line[x_]];
+	}
+
+	// dot 257
+	eval_sprites();
+	copy_x();
+
+	// dots 321-340, the first two tiles of the next line
+	load_sprites();
+	fetch_addr = nt_addr();
+	for (int i = 2 + 32; i < 2 + 34; ++i) {
+		fetch_tile();
+		incr_x();
+		fetch_addr = nt_addr();
+		tiles[i] = { low_tile_byte, high_tile_byte, (uint8_t)(attributetable_byte & 3), 0 };
+	}
+	nametable_byte = read(fetch_addr);
+	fetch_addr = nt_addr();
+	nametable_byte = read(fetch_addr);
+
+	// 16 shifts with reloads at 329 and 337 leave just those two tiles
+	const auto& first = tiles[2 + 32];
+	const auto& second = tiles[2 + 33];
+	background_shift_low = first.low << 8 | second.low;
+	background_shift_high = first.high << 8 | second.high;
+	attribute_shift_low = first.attr & 1 ? 0xFF : 0;
+	attribute_shift_high = first.attr & 2 ? 0xFF : 0;
+	attribute_latch_low = second.attr & 1;
+	attribute_latch_high = second.attr & 2;
+
+	time += line_dots * ppu_dot_ticks;
+	++scan_line;
+}
+
+
+/* What the PPU does on each dot, as a set of actions. step() looks them
+ * up by line type and dot instead of walking the nested switches. */
+enum Dot_action : uint32_t {
+	clear_secondary_oam = BIT(0),
+	clear_flags         = BIT(1),   // sprite 0 hit, overflow and vblank
+	eval_sprites        = BIT(2),
+	load_sprites        = BIT(3),
+	pixel               = BIT(4),
+	reload_shift        = BIT(5),
+	incr_x              = BIT(6),
+	incr_y              = BIT(7),
+	copy_x              = BIT(8),
+	copy_y              = BIT(9),
+	odd_frame_skip      = BIT(10),
+	vblank              = BIT(11),
+	frame_end           = BIT(12),
+	// set on dots with anything besides the per-tile work
+	uncommon            = BIT(13),
+
+	// a dot does at most one step of a background fetch, kept as a number
+	// in the top bits so it takes one switch instead of a chain of tests
+	fetch_shift         = 28,
+	fetch_mask          = 15u << fetch_shift,
+	nt_address          = 1u << fetch_shift,
+	fetch_nt            = 2u << fetch_shift,
+	at_address          = 3u << fetch_shift,
+	fetch_at            = 4u << fetch_shift,
+	bg_address          = 5u << fetch_shift,
+	fetch_low           = 6u << fetch_shift,
+	high_address        = 7u << fetch_shift,
+	fetch_high          = 8u << fetch_shift
+};
+
+using Dot_table = std::array<std::array<uint32_t, 341>, 5>;
+
+static Dot_table make_dot_table()
+{
+	Dot_table table{};
+
+	table[(size_t)Scanline_type::post][0] = frame_end;
+	table[(size_t)Scanline_type::nmi][1] = vblank;
+
+	for (auto type : { Scanline_type::visible, Scanline_type::pre }) {
+		auto& dots = table[(size_t)type];
+		bool pre = type == Scanline_type::pre;
+
+		// sprites
+		dots[1] |= clear_secondary_oam | (pre ? clear_flags : 0);
+		dots[257] |= eval_sprites;
+		dots[321] |= load_sprites;
+
+		// background, 8 dots per tile
+		for (unsigned dot = 2; dot <= 337; ++dot) {
+			if (dot > 255 && dot < 322) {
+				continue;
+			}
+			dots[dot] |= pixel;
+			switch (dot % 8) {
+			case 1: dots[dot] |= nt_address | reload_shift; break;
+			case 2: dots[dot] |= fetch_nt; break;
+			case 3: dots[dot] |= at_address; break;
+			case 4: dots[dot] |= fetch_at; break;
+			case 5: dots[dot] |= bg_address; break;
+			case 6: dots[dot] |= fetch_low; break;
+			case 7: dots[dot] |= high_address; break;
+			case 0: dots[dot] |= fetch_high | incr_x; break;
+			}
+		}
+		dots[256] |= pixel | fetch_high | incr_y;
+		dots[257] |= pixel | reload_shift | copy_x;
+		if (pre) {
+			for (unsigned dot = 280; dot <= 304; ++dot) {
+				dots[dot] |= copy_y;
+			}
+		}
+
+		// no shift reloading
+		dots[1] |= nt_address;
+		dots[321] |= nt_address;
+		dots[339] |= nt_address;
+		// nametable fetches instead of attribute
+		dots[338] |= fetch_nt;
+		dots[340] |= fetch_nt | (pre ? odd_frame_skip : 0);
+	}
+
+	for (auto& dots : table) {
+		for (auto& actions : dots) {
+			if (actions & ~(pixel | reload_shift | incr_x | fetch_mask)) {
+				actions |= uncommon;
+			}
+		}
+	}
+
+	return table;
+}
 
-	switch (scanline_type) {
-	case Scanline_type::nmi:
-		if (dot == 1) {
+static const Dot_table dot_table = make_dot_table();
+
+static const std::array<Scanline_type, 262> line_types = []
+{
+	std::array<Scanline_type, 262> types;
+	types.fill(Scanline_type::idle);
+	for (unsigned line = 0; line < 240; ++line) {
+		types[line] = Scanline_type::visible;
+	}
+	types[240] = Scanline_type::post;
+	types[241] = Scanline_type::nmi;
+	types[261] = Scanline_type::pre;
+	return types;
+}();
+
+/* Execute the actions of a dot: sprites first, then the pixel, the
+ * background fetch step and the scroll updates. */
+void Ppu::dot_actions(uint32_t actions)
+{
+	if (actions & Dot_action::uncommon) {
+		if (actions & Dot_action::vblank) {
 			status.nmi_occurred = 1;
 			if (control.nmi_output) {
 				cpu.trigger(Cpu::Interrupt::nmi);
 			}
 		}
-		break;
-	case Scanline_type::post:
-		if (dot == 0) {
-			screen.swap();
-			screen.render();
+		if (actions & Dot_action::frame_end) {
+			video.swap();
+			++frame;
+			render_stats = frame_render_stats;
+			frame_render_stats = Render_stats{};
+			cpu.end_frame();
 		}
-		break;
-	case Scanline_type::visible:
-	case Scanline_type::pre:
-		// Sprites:
-		switch (dot) {
-		case 1:
+		if (actions & Dot_action::clear_secondary_oam) {
 			secondary_oam.clear();
-			if (scanline_type == Scanline_type::pre) {
-				status.sprite_overflow = 0;
-				status.sprite_zero_hit = 0;
-			}
-			break;
-		case 257:
+		}
+		if (actions & Dot_action::clear_flags) {
+			status.sprite_overflow = 0;
+			status.sprite_zero_hit = 0;
+			status.nmi_occurred = 0;
+		}
+		if (actions & Dot_action::eval_sprites) {
 			eval_sprites();
-			break;
-		case 321:
+		}
+		if (actions & Dot_action::load_sprites) {
 			load_sprites();
-			break;
 		}
+	}
 
-		// Background:
-		switch (dot) {
-		case 2 ... 255:
-		case 322 ... 337:
-			pixel();
-			switch (dot % 8) {
-			// Nametable:
-			case 1:
-				addr = nt_addr();
-				reload_shift();
-				break;
-			case 2:
-				nametable_byte = read(addr);
-				break;
-			// Attribute:
-			case 3:
-				addr = at_addr();
-				break;
-			case 4:
-				attributetable_byte = read(addr);
-				if (v.coarse_y & 2) {
-					attributetable_byte >>= 4;
-				}
-				if (v.coarse_y & 2) {
-					attributetable_byte >>= 2;
-				}
-				break;
-			// Background (low bits):
-			case 5:
-				addr = bg_addr();
-				break;
-			case 6:
-				low_tile_byte = read(addr);
-				break;
-			// Background (high bits):
-			case 7:
-				addr += 8;
-				break;
-			case 0:
-				high_tile_byte = read(addr);
-				incr_x();  // h_scroll
-				break;
-			}
-			break;
-		case 256:  // Vertical bump.
-			pixel();
-			high_tile_byte = read(addr);
-			incr_y();
-			break;
-		case 257:  // Update horizontal position.
-			pixel();
-			reload_shift();
-			copy_x(); //h_update();
-			break;
-		case 280 ... 304:
-			if (scanline_type == Scanline_type::pre) {
-				// Update vertical position.
-				copy_y();
-			}
-			break;
+	if (actions & Dot_action::pixel) {
+		pixel();
+	}
 
-		// No shift reloading:
-		case 1:
-			addr = nt_addr();
-			if (scanline_type == Scanline_type::pre) {
-				status.nmi_occurred = 0;
-			}
-			break;
-		case 321:
-		case 339:
-			addr = nt_addr();
-			break;
-		// Nametable fetch instead of attribute:
-		case 338:
-			nametable_byte = read(addr);
-			break;
-		case 340:
-			nametable_byte = read(addr);
-			if (scanline_type == Scanline_type::pre && rendering() && f) {
-				++dot;
-			}
-			break;
-		}
+	switch (actions & Dot_action::fetch_mask) {
+	case Dot_action::nt_address:
+		fetch_addr = nt_addr();
+		break;
+	case Dot_action::fetch_nt:
+		nametable_byte = read(fetch_addr);
+		break;
+	case Dot_action::at_address:
+		fetch_addr = at_addr();
+		break;
+	case Dot_action::fetch_at:
+		attributetable_byte = tile_palette();
+		break;
+	case Dot_action::bg_address:
+		fetch_addr = bg_addr();
+		break;
+	case Dot_action::fetch_low:
+		low_tile_byte = read(fetch_addr);
+		break;
+	case Dot_action::high_address:
+		fetch_addr += 8;
+		break;
+	case Dot_action::fetch_high:
+		high_tile_byte = read(fetch_addr);
+		break;
+	}
+
+	if (actions & Dot_action::reload_shift) {
+		reload_shift();
+	}
+	if (actions & Dot_action::incr_x) {
+		incr_x();
+	}
 
-		// Signal scanline to mapper:
-		if (dot == 260 && rendering()) {
-			// TODO
-			//cart->signal_scanline();
+	if (actions & Dot_action::uncommon) {
+		if (actions & Dot_action::incr_y) {
+			incr_y();
+		}
+		if (actions & Dot_action::copy_x) {
+			copy_x();
+		}
+		if (actions & Dot_action::copy_y) {
+			copy_y();
+		}
+		if ((actions & Dot_action::odd_frame_skip) && rendering() && f) {
+			++dot;
 		}
-		break;
 	}
 }
 
 /* Execute a PPU cycle. */
 void Ppu::step()
 {
-	switch (scan_line) {
-	case 0 ... 239:
-		scanline_cycle(Scanline_type::visible);
-		break;
-	case 240:
-		scanline_cycle(Scanline_type::post);
-		break;
-	case 241:
-		scanline_cycle(Scanline_type::nmi);
-		break;
-	case 261:
-		scanline_cycle(Scanline_type::pre);
-		break;
+	auto actions = dot_table[(size_t)line_types[scan_line]][dot];
+	if (actions) {
+		dot_actions(actions);
 	}
+
 	// Update dot and scanline counters:
+	time += ppu_dot_ticks;
 	++dot;
 	if (dot > 340) {
 		dot %= 341;
@@ -541,3 +977,20 @@ void Ppu::step()
 	}
 }
 
+/* Visible lines are drawn in one pass when the PPU is not observed before
+ * they end, anything else (raster effects, sprite 0 polling) dot by dot. */
+void Ppu::run_until(Master_time until)
+{
+	while (time < until) {
+		if (dot == 0 && scan_line < 240) {
+			if (until - time >= line_dots * ppu_dot_ticks) {
+				render_line();
+				++frame_render_stats.line_path;
+				continue;
+			}
+			++frame_render_stats.dot_path;
+		}
+		step();
+	}
+}
+
@@ -1,26 +1,19 @@
 #ifndef NESEMU_PPU_H
 #define NESEMU_PPU_H
 
-#include "screen.h"
+#include "video.h"
 #include "memory.h"
 #include "cpu.h"
+#include "compositor.h"
 
 class Memory;
 class Cpu;
-
-const std::array<Color, 64> palette = {
-	0x666666, 0x002A88, 0x1412A7, 0x3B00A4, 0x5C007E, 0x6E0040, 0x6C0600, 0x561D00,
-	0x333500, 0x0B4800, 0x005200, 0x004F08, 0x00404D, 0x000000, 0x000000, 0x000000,
-	0xADADAD, 0x155FD9, 0x4240FF, 0x7527FE, 0xA01ACC, 0xB71E7B, 0xB53120, 0x994E00,
-	0x6B6D00, 0x388700, 0x0C9300, 0x008F32, 0x007C8D, 0x000000, 0x000000, 0x000000,
-	0xFFFEFF, 0x64B0FF, 0x9290FF, 0xC676FF, 0xF36AFF, 0xFE6ECC, 0xFE8170, 0xEA9E22,
-	0xBCBE00, 0x88D800, 0x5CE430, 0x45E082, 0x48CDDE, 0x4F4F4F, 0x000000, 0x000000,
-	0xFFFEFF, 0xC0DFFF, 0xD3D2FF, 0xE8C8FF, 0xFBC2FF, 0xFEC4EA, 0xFECCC5, 0xF7D8A5,
-	0xE4E594, 0xCFEF96, 0xBDF4AB, 0xB3F3CC, 0xB5EBF2, 0xB8B8B8, 0x000000, 0x000000
-};
+class Scheduler;
+class Cartridge;
+class Console;
 
 enum class Scanline_type {
-	visible, post, nmi, pre
+	visible, post, nmi, idle, pre
 };
 
 union Vram_register {
@@ -67,8 +60,9 @@ private:
 class Palette_table {
 public:
 	uint8_t& at(unsigned idx) { return data.at(idx); }
+	const uint8_t* raw() const { return data.data(); }
 private:
-	std::array<uint8_t, 0x20> data;
+	std::array<uint8_t, 0x20> data{};
 };
 
 using Control = FLAG_BYTE({
@@ -110,14 +104,17 @@ struct Sprite_obj {
 		unsigned flip_vertical     : 1;
 	}) attr;
 	uint8_t x;
-	uint8_t dataL, dataH;
 	uint8_t id;
+	// the row of the line being drawn, see Tile_cache (already flipped)
+	uint64_t pixels;
 };
 
 template <size_t Sz>
 struct Sprite_data {
 	static const size_t size = Sz;
-	Sprite_obj sprites[Sz];
+	Sprite_obj sprites[Sz]{};
+	// slots from here on are known to be clear
+	size_t used = Sz;
 
 	uint8_t& at(size_t idx)
 	{
@@ -139,33 +136,125 @@ struct Sprite_data {
 	void clear();
 };
 
+template <size_t Sz>
+const size_t Sprite_data<Sz>::size;
+
+/* CHR pattern tiles decoded to one byte (the 2-bit color) per pixel: a row
+ * of 8 in a uint64_t, leftmost pixel in the low byte, so drawing copies
+ * 8 pixels at once. Rows are also kept mirrored for flipped sprites. */
+class Tile_cache {
+public:
+	// rows are looked up by the address of their low bitplane byte
+	uint64_t row(uint16_t addr) const
+	{
+		return rows[index(addr)];
+	}
+
+	uint64_t flipped_row(uint16_t addr) const
+	{
+		return flipped_rows[index(addr)];
+	}
+
+	void decode(const std::vector<uint8_t>& chr);
+	// the CHR byte at addr changed
+	void update(const std::vector<uint8_t>& chr, uint16_t addr);
+
+	static uint64_t decode_row(uint8_t low, uint8_t high);
+
+private:
+	static const size_t tile_count = 0x2000 / 16;
+
+	std::array<uint64_t, tile_count * 8> rows{};
+	std::array<uint64_t, tile_count * 8> flipped_rows{};
+
+	static size_t index(uint16_t addr)
+	{
+		return (addr >> 4) * 8 + (addr & 7);
+	}
+};
+
 class Ppu {
 public:
-	unsigned cycle = 0;
+	// master clock time the PPU has run up to
+	Master_time time = 0;
+
+	struct Render_stats {
+		// visible lines drawn in one pass, see render_line
+		unsigned line_path;
+		// visible lines drawn dot by dot
+		unsigned dot_path;
+		// lines of the one-pass ones that reused the previous background
+		unsigned background_reused;
+	};
+	// counts of the last complete frame
+	Render_stats render_stats{};
 
-	Ppu();
+	explicit Ppu(Console& console);
+
+	Ppu(const Ppu&) = delete;
+	Ppu& operator=(const Ppu&) = delete;
 
 	void reset();
 	void step();
+	// run dots up to master clock time until
+	void run_until(Master_time until);
+	// post the next PPU events, see scheduler.h
+	void post_events(Scheduler& scheduler) const;
 	uint8_t read_register(uint16_t address);
 	void write_register(uint16_t address, uint8_t value);
 	uint8_t read(uint16_t addr);
 	void write(uint16_t addr, uint8_t value);
 
+	// what reading $2002 would return, without its side effects
+	uint8_t peek_status() const;
+	// the CHR byte at addr changed (PPU or mapper write)
+	void chr_written(uint16_t addr);
+	// dots until $2002 may read differently or an NMI may be raised
+	unsigned dots_until_event();
+	unsigned frame_count() const;
+
+	// the PPU's own memory, to look at a running game from outside:
+	// 2 KB of nametables, 32 bytes of palettes and 256 of OAM
+	const uint8_t* nametables() const;
+	const uint8_t* palettes() const;
+	const uint8_t* oam() const;
+
 private:
+	static const unsigned line_dots = 341;
+	static const unsigned frame_lines = 262;
+
+	// the rest of the console
+	Cpu& cpu;
+	Memory& memory;
+	Scheduler& scheduler;
+	Video& video;
+	std::unique_ptr<Cartridge>& cart;
+
 	unsigned scan_line = 0;
 	unsigned dot = 0;
 	unsigned frame = 0;
 
 	Palette_table palette_data;
-	std::array<uint8_t, 0x800> nametable_data;
+	std::array<uint8_t, 0x800> nametable_data{};
+	// the 2-bit palette of each tile from the attribute tables, indexed by
+	// the tile's nametable_data index
+	std::array<uint8_t, 0x800> tile_palettes{};
 
-	std::array<uint8_t, 0x100> oam_data;
+	std::array<uint8_t, 0x100> oam_data{};
 	Sprite_data<8> primary_oam, secondary_oam;
 
+	// OAM entries covering each line, see index_sprites; rebuilt when a
+	// Y coordinate or the sprite size changes
+	static const unsigned max_line_sprites = 9;
+	std::array<std::array<uint8_t, max_line_sprites>, 256 + 16> line_sprites;
+	std::array<uint8_t, 256 + 16> line_sprite_counts;
+	bool sprites_indexed = false;
+	// primary OAM drawn for the line, one lookup per pixel
+	std::array<uint8_t, line_width> sprite_line{};
+
 	// PPU registers
-	Vram_register v;
-	Vram_register t;
+	Vram_register v{};
+	Vram_register t{};
 
 	uint8_t x = 0;
 	uint8_t w = 0;
@@ -185,16 +274,55 @@ private:
 
 	// Background shift registers:
 	// TODO: rename or remove these
-	uint8_t attribute_shift_low;
-	uint8_t attribute_shift_high;
-	uint16_t background_shift_low;
-	uint16_t background_shift_high;
-	bool attribute_latch_low;
-	bool attribute_latch_high;
+	uint8_t attribute_shift_low = 0;
+	uint8_t attribute_shift_high = 0;
+	uint16_t background_shift_low = 0;
+	uint16_t background_shift_high = 0;
+	bool attribute_latch_low = false;
+	bool attribute_latch_high = false;
+
+	Control control{};
+	Mask mask{};
+	Status status{};
+
+	uint16_t fetch_addr = 0;
+	Tile_cache chr_tiles;
+
+	// PPU state at dot 0 that the background of a line depends on
+	struct Background_key {
+		uint16_t v;
+		uint16_t shift_low, shift_high;
+		uint8_t x;
+		uint8_t attribute_shift_low, attribute_shift_high;
+		// attribute latches, background table and rendering
+		uint8_t flags;
+
+		bool operator==(const Background_key& other) const
+		{
+			return v == other.v && shift_low == other.shift_low
+				&& shift_high == other.shift_high && x == other.x
+				&& attribute_shift_low == other.attribute_shift_low
+				&& attribute_shift_high == other.attribute_shift_high
+				&& flags == other.flags;
+		}
+	};
 
-	Control control;
-	Mask mask;
-	Status status;
+	// a background line drawn by render_line and the fetch state it left
+	struct Background_line {
+		Background_key key;
+		// vram_generation when drawn
+		unsigned generation = 0;
+		std::array<uint8_t, line_width> pixels;
+		uint16_t v;
+		uint16_t fetch_addr;
+		uint8_t nametable_byte, attributetable_byte;
+		uint8_t low_tile_byte, high_tile_byte;
+	};
+
+	// bumped by every nametable or CHR write, invalidating background_lines
+	unsigned vram_generation = 1;
+	std::array<Background_line, 240> background_lines;
+	Render_stats frame_render_stats{};
 
 	uint8_t oam_address = 0;
 	uint8_t buffered_data = 0;
@@ -207,18 +335,26 @@ private:
 	bool rendering();
 	int spr_height();
 
+	uint16_t nt_mirror(uint16_t addr);
 	uint16_t nt_addr();
 	uint16_t at_addr();
+	void update_tile_palettes(uint16_t index);
+	uint8_t tile_palette();
 	uint16_t bg_addr();
 
 	void reload_shift();
+	void write_oam(uint8_t value);
+	void index_sprites();
 	void eval_sprites();
 	void load_sprites();
+	void fetch_tile();
+	uint8_t sprite_pixel(int x_, uint8_t palette_nr);
+	void draw_sprite_line();
 	void pixel();
-	void scanline_cycle(Scanline_type scanline_type);
-};
+	void dot_actions(uint32_t actions);
+	void render_line();
 
-extern Cpu cpu;
-extern Memory memory;
+	Master_time time_of(unsigned line, unsigned line_dot) const;
+};
 
 #endif
@@ -0,0 +1,38 @@
+#include "recompiled.h"
+
+// registrations run during static initialization, keep the list head local
+static const Recompiled*& registered()
+{
+	static const Recompiled* head = nullptr;
+	return head;
+}
+
+Recompiled::Recompiled(uint32_t prg_crc, Run_func run)
+	: prg_crc(prg_crc)
+	, run(run)
+	, next(registered())
+{
+	registered() = this;
+}
+
+const Recompiled* Recompiled::find(uint32_t prg_crc)
+{
+	for (auto* rom = registered(); rom; rom = rom->next) {
+		if (rom->prg_crc == prg_crc) {
+			return rom;
+		}
+	}
+	return nullptr;
+}
+
+uint32_t Recompiled::crc(const std::vector<uint8_t>& data)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for (auto byte : data) {
+		crc ^= byte;
+		for (int i = 0; i < 8; i++) {
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+		}
+	}
+	return ~crc;
+}
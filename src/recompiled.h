@@ -0,0 +1,68 @@
+#ifndef NESEMU_RECOMPILED_H
+#define NESEMU_RECOMPILED_H
+
+#include "cpu_exec.h"
+
+#include <vector>
+#include <cstdint>
+
+/* A ROM translated ahead of time by tools/recompile.cpp (`make recompile`).
+ *
+ * The generated translation unit defines one function holding every
+ * instruction discovered from the interrupt vectors, with a label for each
+ * block entry, and registers it here under the CRC32 of its PRG ROM.
+ * Console::load picks the matching one up; Cpu::step then runs it whenever
+ * program_counter is in ROM and falls back to the JIT or the interpreter
+ * for anything it does not know.
+ *
+ * Like the JIT, generated code calls the interpreter's handlers directly
+ * (but inlined) and leaves before accessing an I/O register, so cycles stay
+ * exact and interrupts are polled between runs. A run also leaves once the
+ * CPU is past its deadline, the next scheduler event, so it stops where
+ * the interpreter would. */
+struct Recompiled {
+	using Run_func = void (*)(Cpu* cpu, Master_time deadline);
+
+	// CPU cycles after which a run returns anyway, so Cpu::step gets to
+	// look for idle loops
+	static const unsigned cycle_budget = 60;
+
+	uint32_t prg_crc;
+	Run_func run;
+	const Recompiled* next;
+
+	Recompiled(uint32_t prg_crc, Run_func run);
+
+	static const Recompiled* find(uint32_t prg_crc);
+	static uint32_t crc(const std::vector<uint8_t>& data);
+
+	// used by generated code
+
+	template <uint8_t opcode>
+	static void exec(Cpu* cpu, uint16_t operand)
+	{
+		cpu->operand = operand;
+		cpu->exec_op<opcode>();
+	}
+
+	// whether the indexed/indirect operand resolves to plain RAM/ROM
+	template <uint8_t opcode>
+	static bool direct(Cpu* cpu, uint16_t operand)
+	{
+		cpu->operand = operand;
+		return Cpu::direct_operand<opcode>(cpu);
+	}
+
+	static bool jumped(Cpu* cpu)
+	{
+		return cpu->jumped;
+	}
+
+	// the interpreter would not start another instruction before the event
+	static bool past(Cpu* cpu, Master_time deadline)
+	{
+		return cpu->time > deadline;
+	}
+};
+
+#endif
@@ -0,0 +1,66 @@
+#include "scheduler.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "nesemu.h"
+
+#include <algorithm>
+
+const Master_time Scheduler::never;
+
+Scheduler::Scheduler(Console& console)
+	: cpu(console.cpu)
+	, ppu(console.ppu)
+{
+	pending.fill(never);
+	earliest = never;
+}
+
+void Scheduler::post(Event event, Master_time time)
+{
+	pending[(size_t)event] = time;
+	earliest = *std::min_element(pending.begin(), pending.end());
+}
+
+void Scheduler::cancel(Event event)
+{
+	post(event, never);
+}
+
+Master_time Scheduler::next() const
+{
+	return earliest;
+}
+
+void Scheduler::run_batch()
+{
+	begin_batch();
+	while (cpu_due()) {
+		cpu.step();
+	}
+	end_batch();
+}
+
+void Scheduler::begin_batch()
+{
+	ppu.post_events(*this);
+}
+
+bool Scheduler::cpu_due() const
+{
+	// an event at time t is the PPU dot starting then, the CPU has to get
+	// past it to see its effects at the next instruction boundary
+	return cpu.time <= earliest;
+}
+
+void Scheduler::end_batch()
+{
+	ppu.run_until(cpu.time);
+}
+
+void Scheduler::run_frame()
+{
+	auto frame = ppu.frame_count();
+	while (ppu.frame_count() == frame) {
+		run_batch();
+	}
+}
@@ -0,0 +1,57 @@
+#ifndef NESEMU_SCHEDULER_H
+#define NESEMU_SCHEDULER_H
+
+#include "common.h"
+
+#include <array>
+#include <cstdint>
+
+class Cpu;
+class Ppu;
+class Console;
+
+/* Runs the CPU and the PPU in batches on the master clock.
+ *
+ * Components post the next point in time at which they may affect another
+ * one. The CPU runs instructions up to the earliest of these events, then
+ * the PPU is caught up to where the CPU stopped. In between the PPU stays
+ * suspended unless the CPU observes it: an access to a PPU register catches
+ * it up first (see Memory::read_io), and so does the idle loop check. */
+class Scheduler {
+public:
+	enum class Event {
+		nmi,        // the vblank flag is set with NMIs enabled
+		frame_end,  // the PPU has completed a picture
+		count
+	};
+
+	explicit Scheduler(Console& console);
+
+	// replaces the pending event of the same kind
+	void post(Event event, Master_time time);
+	void cancel(Event event);
+	Master_time next() const;
+
+	// run until the next event
+	void run_batch();
+	// run_batch in parts, for consoles driven together (see lockstep.h):
+	// begin, step the CPU as long as it is due, end
+	void begin_batch();
+	bool cpu_due() const;
+	void end_batch();
+	// run until the PPU has completed the current frame
+	void run_frame();
+
+private:
+	static const Master_time never = UINT64_MAX;
+
+	// the rest of the console
+	Cpu& cpu;
+	Ppu& ppu;
+
+	// a handful of kinds with one pending event each, a scan beats a heap
+	std::array<Master_time, (size_t)Event::count> pending;
+	Master_time earliest;
+};
+
+#endif
@@ -2,8 +2,6 @@
 #include "common.h"
 #include "config.h"
 
-Screen screen;
-
 static void sdl_assert(bool cond)
 {
 	if (!cond) {
@@ -15,8 +13,8 @@ static void sdl_assert(bool cond)
 
 Screen::Screen()
 {
-	joypad_state[0] = 0;
-	joypad_state[1] = 0;
+	buttons[0] = 0;
+	buttons[1] = 0;
 
 	sdl_assert(SDL_Init(SDL_INIT_EVERYTHING) == 0);
 
@@ -29,40 +27,40 @@ Screen::Screen()
 
 	sdl_assert(window != nullptr);
 
-	surface = SDL_GetWindowSurface(window);
-	sdl_assert(surface != nullptr);
+	renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+	sdl_assert(renderer != nullptr);
+
+	texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+		SDL_TEXTUREACCESS_STREAMING, display_width, display_height);
+	sdl_assert(texture != nullptr);
 }
 
 Screen::~Screen()
 {
+	SDL_DestroyTexture(texture);
+	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
 	SDL_Quit();
 }
 
-void Screen::set_bg(unsigned r, unsigned c, Color value)
-{
-	LOG_FMT("set=%d,%d", r, c);
-	r %= display_height;
-	c %= display_width;
-	back[r][c] = value;
-}
-
-void Screen::swap()
-{
-	std::swap(front, back);
-}
-
-void Screen::render()
+void Screen::present(const Frame& frame)
 {
-	auto pixels = static_cast<Color*>(surface->pixels);
+	// convert straight into the texture's memory, uploaded once per frame
+	void* pixels;
+	int pitch;
+	sdl_assert(SDL_LockTexture(texture, nullptr, &pixels, &pitch) == 0);
 
 	for (int r = 0; r < display_height; ++r) {
+		auto row = reinterpret_cast<Color*>(static_cast<uint8_t*>(pixels) + r * pitch);
+		const Color* row_colors = frame_colors(frame.emphasis[r]);
 		for (int c = 0; c < display_width; ++c) {
-			pixels[r * surface->pitch / 4 + c] = front[r][c];
+			row[c] = row_colors[frame.pixels[r][c]];
 		}
 	}
 
-	SDL_UpdateWindowSurface(window);
+	SDL_UnlockTexture(texture);
+	SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+	SDL_RenderPresent(renderer);
 }
 
 static int button_mapping(Button b)
@@ -87,22 +85,22 @@ static int button_mapping(Button b)
 	}
 }
 
-uint8_t Screen::get_joypad_state(int controller_number)
+uint8_t Screen::joypad_state(int controller_number)
 {
-	return joypad_state[controller_number];
+	return buttons[controller_number];
 }
 
 bool Screen::button_pressed(int controller, Button button)
 {
-	return joypad_state[controller] & BIT(button_mapping(button));
+	return buttons[controller] & BIT(button_mapping(button));
 }
 
 void Screen::set_joypad_state(int controller, Button button)
 {
-	joypad_state[controller] |= BIT(button_mapping(button));
+	buttons[controller] |= BIT(button_mapping(button));
 }
 
 void Screen::clear_joypad_state(int controller, Button button)
 {
-	joypad_state[controller] &= ~BIT(button_mapping(button));
+	buttons[controller] &= ~BIT(button_mapping(button));
 }
\ No newline at end of file
@@ -11,11 +11,7 @@
 #include <memory>
 
 #include "controller.h"
-
-using Color = uint32_t;
-
-const size_t display_width = 256;
-const size_t display_height = 240;
+#include "video.h"
 
 const std::string window_title = "nesemu";
 
@@ -25,29 +21,24 @@ enum class Button {
 	up, down, left, right
 };
 
-class Screen {
+/* The SDL frontend: a window showing the frames, with keyboard input. */
+class Screen : public Video_sink, public Input_source {
 public:
 	Screen();
 	~Screen();
 
-	void set_bg(unsigned r, unsigned c, Color value);
+	void present(const Frame& frame) override;
 
-	void swap();
-	void render();
-
-	uint8_t get_joypad_state(int controller_number);
+	uint8_t joypad_state(int controller_number) override;
 	bool button_pressed(int controller, Button button);
 	void set_joypad_state(int controller, Button button);
 	void clear_joypad_state(int controller, Button button);
 
 private:
 	SDL_Window* window;
-	SDL_Surface* surface;
-	uint8_t joypad_state[2];
-	Color front[display_height][display_width];
-	Color back[display_height][display_width];
+	SDL_Renderer* renderer;
+	SDL_Texture* texture;
+	uint8_t buttons[2];
 };
 
-extern Screen screen;
-
 #endif
@@ -0,0 +1,101 @@
+#include "video.h"
+#include "common.h"
+
+#include <algorithm>
+#include <array>
+#include <utility>
+
+static const Color palette[64] = {
+	0x666666, 0x002A88, 0x1412A7, 0x3B00A4, 0x5C007E, 0x6E0040, 0x6C0600, 0x561D00,
+	0x333500, 0x0B4800, 0x005200, 0x004F08, 0x00404D, 0x000000, 0x000000, 0x000000,
+	0xADADAD, 0x155FD9, 0x4240FF, 0x7527FE, 0xA01ACC, 0xB71E7B, 0xB53120, 0x994E00,
+	0x6B6D00, 0x388700, 0x0C9300, 0x008F32, 0x007C8D, 0x000000, 0x000000, 0x000000,
+	0xFFFEFF, 0x64B0FF, 0x9290FF, 0xC676FF, 0xF36AFF, 0xFE6ECC, 0xFE8170, 0xEA9E22,
+	0xBCBE00, 0x88D800, 0x5CE430, 0x45E082, 0x48CDDE, 0x4F4F4F, 0x000000, 0x000000,
+	0xFFFEFF, 0xC0DFFF, 0xD3D2FF, 0xE8C8FF, 0xFBC2FF, 0xFEC4EA, 0xFECCC5, 0xF7D8A5,
+	0xE4E594, 0xCFEF96, 0xBDF4AB, 0xB3F3CC, 0xB5EBF2, 0xB8B8B8, 0x000000, 0x000000
+};
+
+/* Emphasizing a color darkens the other two channels to about 3/4. */
+static Color emphasize(Color color, uint8_t emphasis)
+{
+	Color result = 0;
+	for (int channel = 0; channel < 3; ++channel) {
+		// red is bits 16-23 of a Color but bit 0 of the emphasis
+		int shift = 16 - 8 * channel;
+		Color value = (color >> shift) & 0xFF;
+		if (emphasis & ~BIT(channel) & 7) {
+			value = value * 3 / 4;
+		}
+		result |= value << shift;
+	}
+	return result;
+}
+
+static std::array<Color, 8 * 64> make_colors()
+{
+	std::array<Color, 8 * 64> colors;
+	for (uint8_t emphasis = 0; emphasis < 8; ++emphasis) {
+		for (int i = 0; i < 64; ++i) {
+			colors[emphasis * 64 + i] = emphasize(palette[i], emphasis);
+		}
+	}
+	return colors;
+}
+
+const Color* frame_colors(uint8_t emphasis)
+{
+	static const auto colors = make_colors();
+	return &colors[(emphasis & 7) * 64];
+}
+
+uint64_t frame_hash(const Frame& frame)
+{
+	uint64_t hash = 14695981039346656037ull;
+	auto bytes = reinterpret_cast<const uint8_t*>(&frame);
+	for (size_t i = 0; i < sizeof frame; ++i) {
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+Hashing_sink::Hashing_sink(bool keep_each)
+	: keep_each(keep_each)
+{
+}
+
+void Hashing_sink::present(const Frame& frame)
+{
+	last = frame_hash(frame);
+	combined = combined * 31 + last;
+	if (keep_each) {
+		hashes.push_back(last);
+	}
+}
+
+Video::Video()
+{
+	// black until the PPU draws a frame
+	for (auto& frame : frames) {
+		std::fill(&frame.pixels[0][0], &frame.pixels[0][0] + display_height * display_width, 0x0F);
+		std::fill(std::begin(frame.emphasis), std::end(frame.emphasis), 0);
+	}
+}
+
+void Video::swap()
+{
+	std::swap(front, back);
+	if (sink) {
+		sink->present(*front);
+	}
+}
+
+void Video::set_sink(Video_sink* sink)
+{
+	this->sink = sink;
+}
+
+const Frame& Video::frame() const
+{
+	return *front;
+}
@@ -0,0 +1,90 @@
+#ifndef NESEMU_VIDEO_H
+#define NESEMU_VIDEO_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+using Color = uint32_t;
+// a 6-bit index into the NES palette, converted to a Color when presented
+using Pixel = uint8_t;
+
+const size_t display_width = 256;
+const size_t display_height = 240;
+
+// a picture as drawn by the PPU
+struct Frame {
+	Pixel pixels[display_height][display_width];
+	// the mask's emphasis bits (red, green, blue from bit 0) of each line
+	uint8_t emphasis[display_height];
+};
+
+// RGB (0xRRGGBB) of the 64 palette indices under the given emphasis
+const Color* frame_colors(uint8_t emphasis);
+// FNV-1a over the palette indices and emphasis, to compare runs
+uint64_t frame_hash(const Frame& frame);
+
+/* Where completed frames go, e.g. a window. Nothing is presented without
+ * one, which is all a headless run needs. */
+class Video_sink {
+public:
+	virtual ~Video_sink() = default;
+
+	// the frame stays valid until the next one is presented
+	virtual void present(const Frame& frame) = 0;
+};
+
+/* Hashes the presented frames (see frame_hash) instead of showing them, to
+ * compare runs. */
+class Hashing_sink : public Video_sink {
+public:
+	uint64_t last = 0;
+	// every frame so far, folded as combined * 31 + hash
+	uint64_t combined = 0;
+	// each frame's hash, only kept if asked for
+	std::vector<uint64_t> hashes;
+
+	explicit Hashing_sink(bool keep_each = false);
+
+	void present(const Frame& frame) override;
+
+private:
+	bool keep_each;
+};
+
+/* The PPU's output, double buffered: it draws into one frame while the
+ * other one is presented. */
+class Video {
+public:
+	Video();
+
+	void set_pixel(unsigned r, unsigned c, Pixel value)
+	{
+		back->pixels[r][c] = value;
+	}
+
+	Pixel* row(unsigned r)
+	{
+		return back->pixels[r];
+	}
+
+	void set_emphasis(unsigned r, uint8_t emphasis)
+	{
+		back->emphasis[r] = emphasis;
+	}
+
+	// hand the drawn frame over to the sink, drawing continues in the other
+	void swap();
+
+	void set_sink(Video_sink* sink);
+	// the last completed frame
+	const Frame& frame() const;
+
+private:
+	Frame frames[2];
+	Frame* front = &frames[0];
+	Frame* back = &frames[1];
+	Video_sink* sink = nullptr;
+};
+
+#endif
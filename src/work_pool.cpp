@@ -0,0 +1,78 @@
+#include "work_pool.h"
+
+#include <thread>
+#include <algorithm>
+
+Work_pool::Work_pool(unsigned threads)
+{
+	for (unsigned i = 0; i < std::max(threads, 1u); ++i) {
+		queues.emplace_back(new Queue);
+	}
+	worker_stats.resize(queues.size());
+}
+
+void Work_pool::run(size_t count, const std::function<void(size_t)>& task)
+{
+	// contiguous shares, so results of one thread come out in order
+	auto workers = queues.size();
+	for (size_t w = 0; w < workers; ++w) {
+		for (size_t i = count * w / workers; i < count * (w + 1) / workers; ++i) {
+			queues[w]->tasks.push_back(i);
+		}
+		worker_stats[w] = Worker_stats{};
+	}
+
+	std::vector<std::thread> threads;
+	for (unsigned w = 1; w < workers; ++w) {
+		threads.emplace_back(&Work_pool::work, this, w, std::cref(task));
+	}
+	work(0, task);
+	for (auto& thread : threads) {
+		thread.join();
+	}
+}
+
+unsigned Work_pool::threads() const
+{
+	return queues.size();
+}
+
+const std::vector<Work_pool::Worker_stats>& Work_pool::stats() const
+{
+	return worker_stats;
+}
+
+bool Work_pool::take(unsigned worker, size_t& task)
+{
+	{
+		auto& own = *queues[worker];
+		std::lock_guard<std::mutex> guard{ own.lock };
+		if (!own.tasks.empty()) {
+			task = own.tasks.front();
+			own.tasks.pop_front();
+			return true;
+		}
+	}
+
+	// nothing is ever queued during a run: once all queues are empty, done
+	for (size_t i = 1; i < queues.size(); ++i) {
+		auto& victim = *queues[(worker + i) % queues.size()];
+		std::lock_guard<std::mutex> guard{ victim.lock };
+		if (!victim.tasks.empty()) {
+			task = victim.tasks.back();
+			victim.tasks.pop_back();
+			++worker_stats[worker].stolen;
+			return true;
+		}
+	}
+	return false;
+}
+
+void Work_pool::work(unsigned worker, const std::function<void(size_t)>& task)
+{
+	size_t next;
+	while (take(worker, next)) {
+		task(next);
+		++worker_stats[worker].tasks;
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef NESEMU_WORK_POOL_H
+#define NESEMU_WORK_POOL_H
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <functional>
+#include <cstddef>
+
+/* Runs numbered tasks on a fixed number of threads. Every thread starts
+ * with an even share of the tasks in its own queue, takes them from the
+ * front and, once it runs out, steals from the back of another queue, so
+ * uneven tasks (long movies, slow ROMs) still keep all threads busy.
+ * Tasks are whole emulator runs, a lock per queue costs nothing next to
+ * them. */
+class Work_pool {
+public:
+	struct Worker_stats {
+		unsigned tasks;
+		// of those, taken from another thread's queue
+		unsigned stolen;
+	};
+
+	explicit Work_pool(unsigned threads);
+
+	// runs task(i) for every i below count, returns once all are done
+	void run(size_t count, const std::function<void(size_t)>& task);
+
+	unsigned threads() const;
+	// of the last run
+	const std::vector<Worker_stats>& stats() const;
+
+private:
+	struct Queue {
+		std::mutex lock;
+		std::deque<size_t> tasks;
+	};
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<Worker_stats> worker_stats;
+
+	bool take(unsigned worker, size_t& task);
+	void work(unsigned worker, const std::function<void(size_t)>& task);
+};
+
+#endif
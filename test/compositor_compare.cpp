@@ -0,0 +1,73 @@
+/* Composites random background and sprite lines under every combination of
+ * the show/clip flags with each version of compose_line (see compositor.h)
+ * and checks that the vector ones draw the same pixels and report the same
+ * sprite 0 hits as the scalar one.
+ *
+ * USAGE: compositor-compare [lines] [seed] */
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstring>
+
+#include "../src/compositor.h"
+
+struct Version {
+	const char* name;
+	Compose_line compose;
+};
+
+int main(int argc, char** argv)
+{
+	unsigned lines = argc > 1 ? std::stoul(argv[1]) : 20000;
+	unsigned seed = argc > 2 ? std::stoul(argv[2]) : 1;
+
+	std::vector<Version> versions{ { "sse2", compose_line_sse2 } };
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		versions.push_back({ "avx2", compose_line_avx2 });
+	} else {
+		std::clog << "no AVX2 here, only checking SSE2\n";
+	}
+
+	std::mt19937 rng{ seed };
+	uint8_t background[line_width], sprites[line_width];
+	unsigned hits = 0;
+	for (unsigned i = 0; i < lines; ++i) {
+		// from empty to full layers, sprite 0 somewhere on some lines
+		unsigned bg_density = rng() % 5, sprite_density = rng() % 5;
+		unsigned sprite0_x = rng() % 2 ? rng() % line_width : line_width;
+		for (unsigned x = 0; x < line_width; ++x) {
+			background[x] = rng() % 4 < bg_density ? 1 + rng() % 15 : 0;
+			sprites[x] = 0;
+			if (rng() % 4 < sprite_density) {
+				sprites[x] = (16 + rng() % 16) | (rng() % 2 ? sprite_behind : 0);
+				if (x - sprite0_x < 8) {
+					sprites[x] |= sprite_zero;
+				}
+			}
+		}
+
+		for (unsigned flags = 0; flags < 16; ++flags) {
+			Line_layers layers{ background, sprites,
+				(flags & 1) != 0, (flags & 2) != 0, (flags & 4) != 0, (flags & 8) != 0 };
+			uint8_t expected[line_width];
+			bool expected_hit = compose_line_scalar(layers, expected);
+			hits += expected_hit;
+
+			for (auto& version : versions) {
+				uint8_t out[line_width];
+				bool hit = version.compose(layers, out);
+				if (hit != expected_hit || memcmp(out, expected, line_width) != 0) {
+					std::clog << version.name << ": line " << i << " with flags " << flags
+						<< " differs from the scalar version\n";
+					return EXIT_FAILURE;
+				}
+			}
+		}
+	}
+
+	std::clog << lines << " lines match under all 16 flag combinations (" << hits << " sprite 0 hits)\n";
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,141 @@
+/* Runs a ROM (and optionally a movie) once per way of executing CPU code and
+ * checks that every frame, the CPU cycle count and the RAM come out the same
+ * as with the plain interpreter. Translated code is only allowed to be
+ * faster: anything that shifts when an NMI arrives shows up as a frame
+ * that differs.
+ *
+ * ROMs translated by `make recompile` are linked in and compared too.
+ *
+ * USAGE: cpu-compare rom.nes [movie.fm2|-] [frames] */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <array>
+
+#include "../src/nesemu.h"
+#include "../src/movie.h"
+#include "../src/jit.h"
+
+std::ostream& logger = std::clog;
+
+enum class Engine {
+	interpreter, jit, recompiled
+};
+
+static const char* engine_name(Engine engine)
+{
+	switch (engine) {
+	case Engine::interpreter: return "interpreter";
+	case Engine::jit: return "jit";
+	case Engine::recompiled: return "recompiled";
+	}
+	return "?";
+}
+
+struct Run {
+	std::vector<uint64_t> frame_hashes;
+	std::vector<uint64_t> cycles;
+	std::array<uint8_t, 0x800> ram;
+};
+
+// the frame hashes, and the CPU cycle count at each frame
+class Cycles_sink : public Hashing_sink {
+public:
+	std::vector<uint64_t> cycles;
+	Console& console;
+
+	explicit Cycles_sink(Console& console)
+		: Hashing_sink(true)
+		, console(console)
+	{
+	}
+
+	void present(const Frame& frame) override
+	{
+		Hashing_sink::present(frame);
+		cycles.push_back(console.cpu.cycles());
+	}
+};
+
+static Run run_rom(const std::string& rom, Movie movie, unsigned frames, Engine engine)
+{
+	Run run;
+	std::unique_ptr<Console> console{ new Console };
+	console->load(rom);
+	if (engine != Engine::recompiled) {
+		console->cpu.set_recompiled(nullptr);
+	}
+	console->cpu.set_jit(engine == Engine::jit);
+
+	Cycles_sink sink{ *console };
+	console->video.set_sink(&sink);
+	console->controllers.set_input(&movie);
+
+	for (unsigned i = 0; i < frames; ++i) {
+		console->scheduler.run_frame();
+		movie.next_frame();
+	}
+	run.frame_hashes = std::move(sink.hashes);
+	run.cycles = std::move(sink.cycles);
+	for (uint16_t addr = 0; addr < run.ram.size(); ++addr) {
+		run.ram[addr] = console->memory.read(addr);
+	}
+	return run;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		logger << "usage: cpu-compare rom.nes [movie.fm2|-] [frames]\n";
+		return EXIT_FAILURE;
+	}
+	std::string rom{ argv[1] };
+	Movie movie;
+	if (argc > 2 && std::string{ argv[2] } != "-") {
+		std::ifstream file{ argv[2] };
+		if (!file.is_open()) {
+			logger << "cannot open " << argv[2] << '\n';
+			return EXIT_FAILURE;
+		}
+		movie = Movie::from_fm2(file);
+	}
+	unsigned frames = argc > 3 ? std::stoul(argv[3]) : 600;
+
+	std::vector<Engine> engines;
+	if (Jit::available()) {
+		engines.push_back(Engine::jit);
+	}
+	{
+		std::unique_ptr<Console> console{ new Console };
+		console->load(rom);
+		if (Recompiled::find(Recompiled::crc(console->cart->rom))) {
+			engines.push_back(Engine::recompiled);
+		}
+	}
+
+	auto reference = run_rom(rom, movie, frames, Engine::interpreter);
+	bool same = true;
+	for (auto engine : engines) {
+		auto run = run_rom(rom, movie, frames, engine);
+		for (size_t i = 0; i < reference.frame_hashes.size(); ++i) {
+			if (i >= run.frame_hashes.size() || run.frame_hashes[i] != reference.frame_hashes[i]
+				|| run.cycles[i] != reference.cycles[i]) {
+				logger << engine_name(engine) << ": frame " << i << " differs from the interpreter\n";
+				same = false;
+				break;
+			}
+		}
+		if (run.ram != reference.ram) {
+			logger << engine_name(engine) << ": RAM differs from the interpreter\n";
+			same = false;
+		}
+		if (same) {
+			logger << engine_name(engine) << ": " << reference.frame_hashes.size() << " frames match\n";
+		}
+	}
+
+	return same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,279 @@
+/* Runs the PPUs of two consoles side by side through random VRAM, OAM and
+ * register writes at random times: one steps every dot, the other runs
+ * through run_until, which draws the visible lines nothing falls in with
+ * render_line (reusing unchanged backgrounds). Every frame and the status
+ * register seen by each write have to come out the same.
+ *
+ * Then both draw frames scrolled to every tile row, 30 and 31 included,
+ * which are checked against the background fetched by hand.
+ *
+ * USAGE: ppu-compare [frames] [seed] */
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "../src/nesemu.h"
+
+std::ostream& logger = std::clog;
+
+static const Master_time line_ticks = 341 * ppu_dot_ticks;
+static const Master_time frame_ticks = 262 * line_ticks;
+
+struct Write {
+	enum Kind { vram, reg, read_status } kind;
+	uint16_t addr;
+	uint8_t value;
+};
+
+class Random_writes {
+public:
+	explicit Random_writes(unsigned seed)
+		: rng(seed)
+	{
+	}
+
+	unsigned below(unsigned n)
+	{
+		return rng() % n;
+	}
+
+	// what a game might do between two looks at the PPU
+	std::vector<Write> next()
+	{
+		std::vector<Write> writes;
+		switch (below(16)) {
+		case 0:
+			// a new screen: nametables, attributes and palettes
+			for (uint16_t addr = 0x2000; addr < 0x2800; ++addr) {
+				writes.push_back({ Write::vram, addr, (uint8_t)below(256) });
+			}
+			for (uint16_t addr = 0x3F00; addr < 0x3F20; ++addr) {
+				writes.push_back({ Write::vram, addr, (uint8_t)below(64) });
+			}
+			break;
+		case 1:
+			// a CHR tile
+			for (uint16_t addr = below(0x200) * 16, end = addr + 16; addr < end; ++addr) {
+				writes.push_back({ Write::vram, addr, (uint8_t)below(256) });
+			}
+			break;
+		case 2:
+			// sprites, bunched up on a few lines now and then
+			writes.push_back({ Write::reg, 0x2003, 0 });
+			for (unsigned i = 0; i < 64; ++i) {
+				unsigned y = below(4) ? below(256) : 100 + below(12);
+				writes.push_back({ Write::reg, 0x2004, (uint8_t)y });
+				writes.push_back({ Write::reg, 0x2004, (uint8_t)below(256) });
+				writes.push_back({ Write::reg, 0x2004, (uint8_t)below(256) });
+				writes.push_back({ Write::reg, 0x2004, (uint8_t)below(256) });
+			}
+			break;
+		case 3:
+		case 4:
+			// scroll, as a status read and two $2005 writes
+			writes.push_back({ Write::read_status, 0x2002, 0 });
+			writes.push_back({ Write::reg, 0x2005, (uint8_t)below(256) });
+			writes.push_back({ Write::reg, 0x2005, (uint8_t)below(256) });
+			break;
+		case 5:
+			writes.push_back({ Write::reg, 0x2006, (uint8_t)below(256) });
+			writes.push_back({ Write::reg, 0x2006, (uint8_t)below(256) });
+			break;
+		case 6:
+			writes.push_back({ Write::reg, 0x2007, (uint8_t)below(256) });
+			break;
+		case 7:
+			writes.push_back({ Write::reg, 0x2000, (uint8_t)below(256) });
+			break;
+		case 8:
+		case 9:
+			// mostly rendering, every flag combination now and then
+			writes.push_back({ Write::reg, 0x2001, (uint8_t)(below(4) ? 0x1E : below(256)) });
+			break;
+		case 10:
+			writes.push_back({ Write::vram, (uint16_t)(0x2000 + below(0x1000)), (uint8_t)below(256) });
+			break;
+		case 11:
+			writes.push_back({ Write::read_status, 0x2002, 0 });
+			break;
+		default:
+			// just looking
+			break;
+		}
+		return writes;
+	}
+
+	// time until the next look: within a line, a few lines or whole frames
+	Master_time next_delay()
+	{
+		switch (below(3)) {
+		case 0: return 1 + below(341) * ppu_dot_ticks;
+		case 1: return 1 + below(16) * line_ticks;
+		default: return 1 + below(2 * frame_ticks);
+		}
+	}
+
+private:
+	std::mt19937 rng;
+};
+
+static uint8_t apply(Ppu& ppu, const std::vector<Write>& writes)
+{
+	uint8_t status = 0;
+	for (auto& write : writes) {
+		switch (write.kind) {
+		case Write::vram:
+			ppu.write(write.addr, write.value);
+			break;
+		case Write::reg:
+			ppu.write_register(write.addr, write.value);
+			break;
+		case Write::read_status:
+			status = ppu.read_register(write.addr);
+			break;
+		}
+	}
+	return status;
+}
+
+// by_dots: one dot at a time, as step() does, instead of through run_until
+static void run(Ppu& ppu, bool by_dots, Master_time until)
+{
+	if (by_dots) {
+		while (ppu.time < until) {
+			ppu.step();
+		}
+	} else {
+		ppu.run_until(until);
+	}
+}
+
+static void run_to_vblank(Ppu& ppu, bool by_dots)
+{
+	// at most 2 lines past the end of the frame
+	auto frame = ppu.frame_count();
+	while (ppu.frame_count() == frame) {
+		run(ppu, by_dots, ppu.time + 2 * line_ticks);
+	}
+}
+
+/* Draws a random screen at the Y scrolls that show every tile row: 0 and
+ * 240-255, where rows 30 and 31 (the attribute bytes) come first and no row
+ * wraps past 29. Each pixel has to be the one the nametable, attribute
+ * (decoded like at_addr) and pattern bytes read by hand make. */
+static bool check_attributes(Console& console, bool by_dots, Random_writes& random)
+{
+	auto& ppu = console.ppu;
+	std::vector<unsigned> scrolls{ 0 };
+	for (unsigned scroll_y = 240; scroll_y < 256; ++scroll_y) {
+		scrolls.push_back(scroll_y);
+	}
+
+	for (auto scroll_y : scrolls) {
+		run_to_vblank(ppu, by_dots);
+		for (uint16_t addr = 0; addr < 0x2800; ++addr) {
+			ppu.write(addr, random.below(256));
+		}
+		for (uint16_t addr = 0x3F00; addr < 0x3F20; ++addr) {
+			ppu.write(addr, random.below(64));
+		}
+		// nametable 0 or 1: copy_x drops the vertical nametable bit
+		uint8_t control = random.below(2) | random.below(2) << 4;
+		uint8_t scroll_x = random.below(256);
+		ppu.write_register(0x2000, control);
+		// the background only, left column included
+		ppu.write_register(0x2001, 0x0A);
+		ppu.read_register(0x2002);
+		ppu.write_register(0x2005, scroll_x);
+		ppu.write_register(0x2005, scroll_y);
+		run_to_vblank(ppu, by_dots);
+
+		const auto& pixels = console.video.frame().pixels;
+		unsigned coarse_y = scroll_y / 8;
+		unsigned fine_y = scroll_y % 8;
+		for (unsigned y = 0; y < display_height; ++y) {
+			for (unsigned x = 0; x < display_width; ++x) {
+				unsigned column = scroll_x + x;
+				unsigned coarse_x = column / 8 % 32;
+				unsigned nametable = ((control ^ column / 256) & 1) | (control & 2);
+				uint16_t base = 0x2000 | nametable << 10;
+
+				uint8_t tile = ppu.read(base | coarse_y << 5 | coarse_x);
+				uint8_t attribute = ppu.read(base | 0x3C0 | (coarse_y / 4) << 3 | coarse_x / 4);
+				attribute = attribute >> (((coarse_y & 2) << 1) | (coarse_x & 2)) & 3;
+				uint16_t addr = (control >> 4 & 1) * 0x1000 + tile * 16 + fine_y;
+				unsigned bit = 7 - column % 8;
+				unsigned color = (ppu.read(addr) >> bit & 1) | (ppu.read(addr + 8) >> bit & 1) << 1;
+
+				uint8_t expected = ppu.read(0x3F00 + (color ? attribute * 4 + color : 0)) & 0x3F;
+				if (pixels[y][x] != expected) {
+					logger << (by_dots ? "dot by dot" : "in one pass") << ": tile row " << coarse_y
+						<< " (line " << y << ", Y scroll " << scroll_y << ") has the wrong background\n";
+					return false;
+				}
+			}
+			if (++fine_y == 8) {
+				fine_y = 0;
+				coarse_y = (coarse_y + 1) % 32;
+			}
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned frames = argc > 1 ? std::stoul(argv[1]) : 2000;
+	unsigned seed = argc > 2 ? std::stoul(argv[2]) : 1;
+
+	// any mapper 0 ROM with CHR ROM will do, it is all overwritten
+	std::unique_ptr<Console> dots{ new Console };
+	std::unique_ptr<Console> lines{ new Console };
+	dots->load("test/nestest.nes");
+	lines->load("test/nestest.nes");
+
+	Random_writes random{ seed };
+	for (unsigned i = 0; i < 4; ++i) {
+		auto writes = random.next();
+		apply(dots->ppu, writes);
+		apply(lines->ppu, writes);
+	}
+
+	Ppu::Render_stats totals{};
+	while (lines->ppu.frame_count() < frames) {
+		auto until = dots->ppu.time + random.next_delay();
+		run(dots->ppu, true, until);
+		auto frame = lines->ppu.frame_count();
+		run(lines->ppu, false, until);
+
+		if (lines->ppu.frame_count() != frame) {
+			auto& stats = lines->ppu.render_stats;
+			totals.line_path += stats.line_path;
+			totals.dot_path += stats.dot_path;
+			totals.background_reused += stats.background_reused;
+		}
+		if (dots->ppu.time != lines->ppu.time || dots->ppu.frame_count() != lines->ppu.frame_count()
+			|| frame_hash(dots->video.frame()) != frame_hash(lines->video.frame())) {
+			logger << "frame " << frame << " differs\n";
+			return EXIT_FAILURE;
+		}
+
+		auto writes = random.next();
+		if (dots->ppu.peek_status() != lines->ppu.peek_status()
+			|| apply(dots->ppu, writes) != apply(lines->ppu, writes)) {
+			logger << "status differs in frame " << frame << '\n';
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!check_attributes(*dots, true, random) || !check_attributes(*lines, false, random)) {
+		return EXIT_FAILURE;
+	}
+
+	logger << frames << " frames match, " << totals.line_path << " lines in one pass ("
+		<< totals.background_reused << " reused), " << totals.dot_path << " dot by dot\n";
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,144 @@
+/* Runs K consoles on one ROM for N frames, once each on its own and once
+ * in lockstep (see lockstep.h), checks that every console ends up with the
+ * same frames and RAM both ways and prints the speed of each.
+ *
+ * Every console gets its own input: it holds a button picked from its
+ * number and the frame (never start or select), so the consoles drift
+ * apart once the game reacts.
+ *
+ * USAGE: lockstep-bench rom.nes [consoles] [frames] */
+
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "../src/nesemu.h"
+#include "../src/lockstep.h"
+
+std::ostream& logger = std::clog;
+
+class Lane_input : public Input_source {
+public:
+	explicit Lane_input(size_t lane)
+		: lane(lane)
+	{
+	}
+
+	uint8_t joypad_state(int controller_number) override
+	{
+		if (controller_number != 0) {
+			return 0;
+		}
+		// a while on each of A, B and the pad, some lanes never press anything
+		static const uint8_t buttons[] = { BIT(0), BIT(1), BIT(4), BIT(5), BIT(6), BIT(7) };
+		return lane % 4 ? buttons[(lane + frame / 30) % 6] : 0;
+	}
+
+	void next_frame()
+	{
+		++frame;
+	}
+
+private:
+	size_t lane;
+	unsigned frame = 0;
+};
+
+struct Lane {
+	Lane_input input;
+	Hashing_sink sink;
+
+	explicit Lane(size_t lane)
+		: input(lane)
+	{
+	}
+};
+
+static bool same_ram(Console& a, Console& b)
+{
+	for (uint16_t addr = 0; addr < 0x800; ++addr) {
+		if (a.memory.read(addr) != b.memory.read(addr)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+	std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+	return seconds.count();
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		logger << "usage: lockstep-bench rom.nes [consoles] [frames]\n";
+		return EXIT_FAILURE;
+	}
+	std::string rom{ argv[1] };
+	size_t count = argc > 2 ? std::stoul(argv[2]) : 64;
+	unsigned frames = argc > 3 ? std::stoul(argv[3]) : 600;
+
+	std::vector<std::unique_ptr<Lane>> alone_lanes, lockstep_lanes;
+	std::vector<std::unique_ptr<Console>> alone;
+	Lockstep lockstep{ rom, count };
+	for (size_t i = 0; i < count; ++i) {
+		alone_lanes.emplace_back(new Lane{ i });
+		lockstep_lanes.emplace_back(new Lane{ i });
+
+		alone.emplace_back(new Console);
+		alone.back()->load(rom);
+		alone.back()->controllers.set_input(&alone_lanes[i]->input);
+		alone.back()->video.set_sink(&alone_lanes[i]->sink);
+
+		lockstep.console(i).controllers.set_input(&lockstep_lanes[i]->input);
+		lockstep.console(i).video.set_sink(&lockstep_lanes[i]->sink);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned frame = 0; frame < frames; ++frame) {
+		for (size_t i = 0; i < count; ++i) {
+			alone[i]->scheduler.run_frame();
+			alone_lanes[i]->input.next_frame();
+		}
+	}
+	auto alone_seconds = seconds_since(start);
+
+	start = std::chrono::steady_clock::now();
+	for (unsigned frame = 0; frame < frames; ++frame) {
+		lockstep.run_frame();
+		for (auto& lane : lockstep_lanes) {
+			lane->input.next_frame();
+		}
+	}
+	auto lockstep_seconds = seconds_since(start);
+
+	uint64_t instructions = 0;
+	for (size_t i = 0; i < count; ++i) {
+		instructions += alone[i]->cpu.instructions;
+		if (alone_lanes[i]->sink.combined != lockstep_lanes[i]->sink.combined
+			|| alone[i]->cpu.cycles() != lockstep.console(i).cpu.cycles()
+			|| !same_ram(*alone[i], lockstep.console(i))) {
+			logger << "console " << i << " differs in lockstep\n";
+			return EXIT_FAILURE;
+		}
+	}
+
+	auto& stats = lockstep.stats;
+	auto total_frames = (double)count * frames;
+	logger << count << " consoles, " << frames << " frames, " << instructions << " instructions\n"
+		<< "alone:    " << alone_seconds << " s, " << total_frames / alone_seconds << " fps, "
+		<< instructions / alone_seconds / 1e6 << " M instructions/s\n"
+		<< "lockstep: " << lockstep_seconds << " s, " << total_frames / lockstep_seconds << " fps, "
+		<< instructions / lockstep_seconds / 1e6 << " M instructions/s ("
+		<< alone_seconds / lockstep_seconds << "x)\n"
+		<< "grouped:  " << 100.0 * stats.vector_instructions / instructions << "% of instructions, "
+		<< stats.groups << " groups of " << (stats.groups ? (double)stats.group_lanes / stats.groups : 0)
+		<< " consoles, " << (stats.groups ? (double)stats.vector_instructions / stats.group_lanes : 0)
+		<< " instructions each\n";
+
+	return EXIT_SUCCESS;
+}
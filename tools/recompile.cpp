@@ -0,0 +1,273 @@
+/* Static recompiler: translates the code of a mapper 0 ROM reachable from its
+ * interrupt vectors into a C++ translation unit for src/recompiled.h.
+ *
+ * Code only reached through indirect jumps (jump tables) can be added by
+ * passing its addresses as extra entry points.
+ *
+ * USAGE: recompile rom.nes out.cpp [hex entry points...]
+ *        (or `make recompile ROM=rom.nes [ENTRIES="C000 ..."]`) */
+
+#include <map>
+#include <set>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include "../src/nesemu.h"
+
+std::ostream& logger = std::clog;
+
+struct Instr {
+	uint8_t opcode;
+	uint16_t operand;
+	unsigned size;
+};
+
+static std::map<uint16_t, Instr> code;
+static std::set<uint16_t> leaders;
+
+static bool is_branch(const Op& op)
+{
+	return op.penalty == Penalty::branch;
+}
+
+static bool accesses_operand(const Op& op)
+{
+	switch (op.mode) {
+	case Mode::implied:
+	case Mode::accumulator:
+	case Mode::immediate:
+	case Mode::relative:
+		return false;
+	case Mode::indirect:
+		// only jmp, the pointer is read from ROM or RAM
+		return false;
+	default:
+		return op.instr != Instruction::jmp && op.instr != Instruction::jsr;
+	}
+}
+
+// known at translation time to touch only RAM/ROM
+static bool static_direct(Memory& memory, const Op& op, uint16_t operand)
+{
+	switch (op.mode) {
+	case Mode::zero_page_x:
+	case Mode::zero_page_y:
+		return true;
+	case Mode::zero_page:
+	case Mode::absolute:
+		return memory.direct(operand, Cpu::writes_memory(op.instr));
+	default:
+		return false;
+	}
+}
+
+static bool needs_guard(const Op& op)
+{
+	switch (op.mode) {
+	case Mode::absolute_x:
+	case Mode::absolute_y:
+	case Mode::indirect_x:
+	case Mode::indirect_y:
+		return accesses_operand(op);
+	default:
+		return false;
+	}
+}
+
+static bool in_rom(Memory& memory, uint16_t addr, unsigned size)
+{
+	return addr + size <= memory_size
+		&& memory.immutable(addr)
+		&& memory.immutable(addr + size - 1);
+}
+
+/* Recursive descent from the given entry points: follow both ways of every
+ * branch, jumps and subroutine calls, stop at returns and indirect jumps. */
+static void discover(Memory& memory, std::vector<uint16_t> pending)
+{
+	while (!pending.empty()) {
+		uint16_t addr = pending.back();
+		pending.pop_back();
+
+		if (addr < 0x8000) {
+			continue;
+		}
+		leaders.insert(addr);
+
+		while (!code.count(addr)) {
+			uint8_t opcode = memory.read(addr);
+			const auto& op = Cpu::op_info(opcode);
+			unsigned size = Cpu::get_arg_size(op.mode) + 1;
+			if (!op.valid || !in_rom(memory, addr, size)) {
+				break;
+			}
+
+			uint16_t operand = 0;
+			if (size == 2) {
+				operand = memory.read(addr + 1);
+			} else if (size == 3) {
+				operand = memory.read_addr(addr + 1);
+			}
+			code[addr] = Instr{ opcode, operand, size };
+
+			uint16_t next = addr + size;
+
+			if (accesses_operand(op) && !static_direct(memory, op, operand)) {
+				// the interpreter runs this one, resume right after it
+				leaders.insert(next);
+			}
+
+			if (is_branch(op)) {
+				pending.push_back(next + (int8_t)operand);
+			} else if (op.instr == Instruction::jsr) {
+				pending.push_back(operand);
+				leaders.insert(next);
+			} else if (op.instr == Instruction::jmp && op.mode == Mode::absolute) {
+				pending.push_back(operand);
+				break;
+			} else if (Cpu::ends_block(op.instr)) {
+				break;
+			}
+
+			addr = next;
+		}
+	}
+}
+
+static std::string hex(unsigned value, int width)
+{
+	std::ostringstream strm;
+	strm << std::uppercase << std::hex << std::setfill('0') << std::setw(width) << value;
+	return strm.str();
+}
+
+static std::string label(uint16_t addr)
+{
+	return "l_" + hex(addr, 4);
+}
+
+static std::string jump_to(uint16_t addr)
+{
+	if (!code.count(addr)) {
+		return "return;";
+	}
+	return "goto " + label(addr) + ";";
+}
+
+static void emit(Memory& memory, std::ostream& out, const std::string& rom_name, uint32_t crc)
+{
+	// every goto target needs a label, including fall-throughs into code
+	// emitted elsewhere (overlapping decodes)
+	for (auto it = code.begin(); it != code.end(); ++it) {
+		const auto& op = Cpu::op_info(it->second.opcode);
+		uint16_t next = it->first + it->second.size;
+		auto following = std::next(it);
+		bool falls_through = !Cpu::ends_block(op.instr) || is_branch(op);
+		if (falls_through && (following == code.end() || following->first != next)) {
+			leaders.insert(next);
+		}
+		if (is_branch(op)) {
+			leaders.insert(next + (int8_t)it->second.operand);
+		}
+	}
+
+	out << "// generated by tools/recompile.cpp from " << rom_name << ", do not edit\n"
+		<< "#include \"../../src/recompiled.h\"\n\n"
+		<< "namespace {\n\n"
+		<< "using R = Recompiled;\n\n"
+		<< "void run(Cpu* cpu, Master_time deadline)\n"
+		<< "{\n"
+		<< "\tswitch (cpu->program_counter) {\n";
+	for (auto addr : leaders) {
+		if (code.count(addr)) {
+			out << "\tcase 0x" << hex(addr, 4) << ": goto " << label(addr) << ";\n";
+		}
+	}
+	out << "\tdefault: return;\n"
+		<< "\t}\n";
+
+	for (auto it = code.begin(); it != code.end(); ++it) {
+		uint16_t addr = it->first;
+		const auto& instr = it->second;
+		const auto& op = Cpu::op_info(instr.opcode);
+		uint16_t next = addr + instr.size;
+		auto opcode = "0x" + hex(instr.opcode, 2);
+		auto operand = "0x" + hex(instr.operand, 4);
+
+		if (leaders.count(addr)) {
+			out << "\n" << label(addr) << ":\n";
+		}
+
+		out << "\tif (R::past(cpu, deadline)) return;\n";
+
+		if (accesses_operand(op) && !static_direct(memory, op, instr.operand)) {
+			if (!needs_guard(op)) {
+				// I/O register, leave it to the interpreter
+				out << "\treturn;\n";
+				continue;
+			}
+			out << "\tif (!R::direct<" << opcode << ">(cpu, " << operand << ")) return;\n";
+		}
+
+		out << "\tR::exec<" << opcode << ">(cpu, " << operand << ");\n";
+
+		if (is_branch(op)) {
+			out << "\tif (R::jumped(cpu)) { " << jump_to(next + (int8_t)instr.operand) << " }\n";
+		} else if (op.instr == Instruction::jsr
+			|| (op.instr == Instruction::jmp && op.mode == Mode::absolute)) {
+			out << "\t" << jump_to(instr.operand) << "\n";
+			continue;
+		} else if (Cpu::ends_block(op.instr)) {
+			out << "\treturn;\n";
+			continue;
+		}
+
+		auto following = std::next(it);
+		if (following == code.end() || following->first != next) {
+			out << "\t" << jump_to(next) << "\n";
+		}
+	}
+
+	out << "}\n\n"
+		<< "const Recompiled rom{ 0x" << hex(crc, 8) << ", run };\n\n"
+		<< "}\n";
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3) {
+		std::cerr << "USAGE: recompile rom.nes out.cpp [hex entry points...]" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	Console console;
+	console.load(argv[1]);
+
+	if (console.cart->mapper_number != 0) {
+		std::cerr << "only mapper 0 ROMs can be recompiled" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::vector<uint16_t> entries{
+		console.memory.read_addr(Cpu::reset_vec_addr),
+		console.memory.read_addr(Cpu::nmi_vec_addr),
+		console.memory.read_addr(Cpu::irq_vec_addr)
+	};
+	for (int i = 3; i < argc; i++) {
+		entries.push_back(std::stoi(argv[i], nullptr, 16));
+	}
+	discover(console.memory, entries);
+
+	std::ofstream out{ argv[2] };
+	if (!out.is_open()) {
+		std::cerr << "cannot write " << argv[2] << std::endl;
+		return EXIT_FAILURE;
+	}
+	emit(console.memory, out, argv[1], Recompiled::crc(console.cart->rom));
+
+	std::cerr << code.size() << " instructions, " << leaders.size() << " entry points" << std::endl;
+
+	return EXIT_SUCCESS;
+}